@@ -0,0 +1,281 @@
+//
+// Created by delta on 5/17/2025.
+//
+// The whole player without a window or an audio device: demux, decode and
+// resample run as in ArcVP, video frames go to a null sink and PCM to the null
+// audio sink.
+//
+//   arcvp_bench <file> [--realtime] [--seconds N] [--seeks N] [--threads N]
+//               [--seek-mode exact|keyframe]
+//
+// Opens the file (time to the codecs and to the first decoded frame), seeks
+// through it (latency from seekTo to the first frame at the target, as seen
+// by the caller and by the decoder) and scrubs with a seek every UI frame,
+// then plays from the start, as fast as the pipeline allows or paced to the
+// audio clock with --realtime. Finally closes the file and opens it again,
+// which goes through the index cache. Prints one JSON document to stdout,
+// logs go to stderr.
+
+#include <spdlog/sinks/stdout_color_sinks.h>
+
+#include <string>
+#include <thread>
+
+#include "bench_util.h"
+#include "player.h"
+
+using namespace ArcVP;
+
+namespace {
+struct Options {
+  std::string file;
+  bool realtime = false;
+  double seconds = 0;  // 0: until the end of the file
+  int seeks = 9;
+  int threads = 0;
+  SeekMode seek_mode = SeekMode::Exact;
+};
+
+bool parseOptions(int argc, char** argv, Options& options) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--realtime") {
+      options.realtime = true;
+    } else if (arg == "--seconds" && has_value) {
+      options.seconds = std::stod(argv[++i]);
+    } else if (arg == "--seeks" && has_value) {
+      options.seeks = std::stoi(argv[++i]);
+    } else if (arg == "--threads" && has_value) {
+      options.threads = std::stoi(argv[++i]);
+    } else if (arg == "--seek-mode" && has_value) {
+      std::string mode = argv[++i];
+      if (mode != "exact" && mode != "keyframe") {
+        return false;
+      }
+      options.seek_mode =
+          mode == "exact" ? SeekMode::Exact : SeekMode::Keyframe;
+    } else if (options.file.empty() && arg[0] != '-') {
+      options.file = arg;
+    } else {
+      return false;
+    }
+  }
+  return !options.file.empty();
+}
+
+nlohmann::json toJson(LatencyRecorder::Summary summary) {
+  return {{"count", summary.count}, {"mean", summary.mean},
+          {"p50", summary.p50},     {"p90", summary.p90},
+          {"p99", summary.p99},     {"max", summary.max}};
+}
+
+// spread over the file and jumping back and forth, so both short forward
+// seeks and long backward ones are covered
+std::vector<int64_t> seekPattern(int64_t duration_ms, int count) {
+  static constexpr double kPositions[] = {.1, .9, .3, .7, .5, .2, .8, .4, .6};
+  std::vector<int64_t> targets;
+  for (int i = 0; i < count; i++) {
+    targets.push_back(kPositions[i % std::size(kPositions)] * duration_ms);
+  }
+  return targets;
+}
+
+nlohmann::json runSeeks(Player* arc, int count, LatencyRecorder& latency) {
+  auto seeks = nlohmann::json::array();
+  for (int64_t target : seekPattern(arc->durationMs(), count)) {
+    auto start = steady_clock::now();
+    arc->seekTo(target);
+    // what the UI thread is held up by
+    int64_t call_us = elapsedUs(start);
+    FrameQueue::RenderEntry entry;
+    if (!arc->takeVideoFrame(entry)) {
+      spdlog::warn("No frame after seeking to {}ms", target);
+      break;
+    }
+    int64_t us = elapsedUs(start);
+    latency.record(us);
+    seeks.push_back({{"target_ms", target},
+                     {"frame_ms", entry.present_ms},
+                     {"us", us},
+                     {"call_us", call_us}});
+    arc->releaseFrame(entry.frame);
+  }
+  return seeks;
+}
+
+// a held seek key: a seek every UI frame for `count` frames, then the time
+// until the last target is on screen
+nlohmann::json runScrub(Player* arc, int count) {
+  constexpr auto kUiFrame = 16ms;
+  int64_t duration_ms = arc->durationMs();
+  LatencyRecorder calls;
+  int64_t target = 0;
+  for (int i = 0; i < count; i++) {
+    target = duration_ms * (i + 1) / (count + 2);
+    auto start = steady_clock::now();
+    arc->seekTo(target);
+    calls.record(elapsedUs(start));
+    std::this_thread::sleep_until(start + kUiFrame);
+  }
+  auto start = steady_clock::now();
+  FrameQueue::RenderEntry entry;
+  if (!arc->takeVideoFrame(entry)) {
+    spdlog::warn("No frame after scrubbing to {}ms", target);
+    return {};
+  }
+  int64_t settle_us = elapsedUs(start);
+  arc->releaseFrame(entry.frame);
+  return {{"seeks", count},
+          {"call_us", toJson(calls.summary())},
+          {"settle_us", settle_us},
+          {"frame_ms", entry.present_ms}};
+}
+// close() and a second open of the same file, up to its first frame
+nlohmann::json runReopen(Player* arc, const std::string& file) {
+  auto start = steady_clock::now();
+  arc->close();
+  int64_t close_us = elapsedUs(start);
+  if (!arc->open(file.c_str())) {
+    spdlog::error("Unable to reopen {}", file);
+    return {};
+  }
+  arc->startPlayback();
+  FrameQueue::RenderEntry entry;
+  if (!arc->takeVideoFrame(entry)) {
+    spdlog::error("No frame after reopening {}", file);
+    return {};
+  }
+  arc->releaseFrame(entry.frame);
+  const OpenTimings& timings = arc->openTimings();
+  return {{"close_us", close_us},
+          {"codecs_ready_us", timings.codecs_ready_us.load()},
+          {"first_frame_us", timings.first_frame_us.load()},
+          {"probe_attempts", timings.probe_attempts.load()},
+          {"cached_probe", timings.cached_probe.load()}};
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!parseOptions(argc, argv, options)) {
+    std::cerr << "usage: arcvp_bench <file> [--realtime] [--seconds N] "
+                 "[--seeks N] [--threads N] [--seek-mode exact|keyframe]"
+              << std::endl;
+    return 2;
+  }
+  spdlog::set_default_logger(spdlog::stderr_color_mt("arcvp_bench"));
+  spdlog::set_level(spdlog::level::warn);
+
+  Player* arc = Player::instance();
+  arc->setSinkConfig({.null_audio = true, .realtime = options.realtime});
+  arc->setSeekMode(options.seek_mode);
+  if (options.threads > 0) {
+    arc->setDecodeThreadConfig({.thread_count = options.threads});
+  }
+  if (!arc->open(options.file.c_str())) {
+    return 1;
+  }
+  if (!arc->hasVideo()) {
+    spdlog::error("{} has no video stream", options.file);
+    arc->exit();
+    return 1;
+  }
+  arc->startPlayback();
+  if (arc->waitOpenState(OpenState::FirstFrameReady) !=
+      OpenState::FirstFrameReady) {
+    spdlog::error("No first frame from {}", options.file);
+    arc->exit();
+    return 1;
+  }
+  const OpenTimings& timings = arc->openTimings();
+  nlohmann::json open = {{"codecs_ready_us", timings.codecs_ready_us.load()},
+                         {"first_frame_us", timings.first_frame_us.load()},
+                         {"probe_attempts", timings.probe_attempts.load()},
+                         {"cached_probe", timings.cached_probe.load()}};
+
+  LatencyRecorder seek_latency;
+  nlohmann::json seeks = runSeeks(arc, options.seeks, seek_latency);
+  auto first_frame = arc->stats().seek_first_frame.summary();
+  int64_t preroll_frames = arc->stats().preroll_frames;
+  arc->stats().coalesced_seeks = 0;
+  nlohmann::json scrub = runScrub(arc, 30);
+  int64_t coalesced_seeks = arc->stats().coalesced_seeks;
+
+  // the measured run starts over from the beginning with clean stats
+  arc->seekTo(0);
+  arc->stats().reset();
+
+  auto start = steady_clock::now();
+  auto deadline = options.seconds > 0
+                      ? start + duration_cast<steady_clock::duration>(
+                                    duration<double>(options.seconds))
+                      : steady_clock::time_point::max();
+  int64_t frames = 0, late = 0;
+  FrameQueue::RenderEntry entry;
+  while (steady_clock::now() < deadline && arc->takeVideoFrame(entry)) {
+    if (options.realtime) {
+      // present on the player's clock like the UI does
+      auto clock_us = [&] { return arc->getPlayedUs(); };
+      int64_t due_us = entry.present_ms * 1000;
+      while (clock_us() < due_us && steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(1ms);
+      }
+      int64_t error_us = clock_us() - due_us;
+      arc->stats().present_error.record(error_us);
+      arc->degradation().observe(error_us / 1000, arc->videoQueueFill(),
+                                 nowUs());
+      if (error_us > kMaxLateMs * 1000) {
+        late++;
+      }
+    }
+    frames++;
+    arc->releaseFrame(entry.frame);
+  }
+  double seconds = duration<double>(steady_clock::now() - start).count();
+
+  PipelineStats& stats = arc->stats();
+  const AVCodecContext* video_ctx = arc->videoCodecContext();
+  nlohmann::json out;
+  out["file"] = options.file;
+  out["mode"] = options.realtime ? "realtime" : "fast";
+  out["decode"] = {{"codec", video_ctx->codec->name},
+                   {"threads", video_ctx->thread_count},
+                   {"thread_type", threadTypeName(video_ctx->active_thread_type)},
+                   {"frames", frames},
+                   {"seconds", seconds},
+                   {"fps", seconds > 0 ? frames / seconds : 0},
+                   {"pix_fmt", av_get_pix_fmt_name(video_ctx->pix_fmt)},
+                   {"output_pix_fmt",
+                    av_get_pix_fmt_name(arc->videoOutputFormat())}};
+  out["dropped_frames"] = stats.dropped_frames + late;
+  out["degradation"] = degradationLevelName(arc->degradation().level());
+  out["latency_us"] = {{"demux", toJson(stats.demux.summary())},
+                       {"video_decode", toJson(stats.video_decode.summary())},
+                       {"audio_decode", toJson(stats.audio_decode.summary())},
+                       {"resample", toJson(stats.resample.summary())},
+                       {"convert", toJson(stats.convert.summary())},
+                       {"queue_wait", toJson(stats.queue_wait.summary())},
+                       {"present_error", toJson(stats.present_error.summary())},
+                       {"av_offset", toJson(stats.av_offset.summary())}};
+  out["open"] = open;
+  out["seek"] = {
+      {"mode", options.seek_mode == SeekMode::Exact ? "exact" : "keyframe"},
+      {"latency_us", toJson(seek_latency.summary())},
+      {"first_frame_us", toJson(first_frame)},
+      {"preroll_frames", preroll_frames},
+      {"seeks", seeks},
+      {"scrub", scrub},
+      {"coalesced_seeks", coalesced_seeks}};
+  out["pools"] = {{"frame_hits", arc->framePool().hits()},
+                  {"frame_misses", arc->framePool().misses()},
+                  {"packet_hits", arc->packetPool().hits()},
+                  {"packet_misses", arc->packetPool().misses()}};
+  // the codec context above is gone after this
+  out["reopen"] = runReopen(arc, options.file);
+  out["peak_rss_kb"] = bench::peakRssKb();
+  std::cout << out.dump(2) << std::endl;
+
+  arc->exit();
+  return 0;
+}
@@ -0,0 +1,98 @@
+//
+// Created by delta on 5/13/2025.
+//
+
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include <nlohmann/json.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace ArcVP::bench {
+using namespace std::chrono;
+
+struct Result {
+  std::string name;
+  int64_t iterations = 0;
+  double ns_per_op = 0;
+  nlohmann::json params = nlohmann::json::object();
+};
+
+// runs `fn(iterations)` once to warm up and then `repeats` times, keeping the
+// fastest run
+template <typename Fn>
+Result run(std::string name, int64_t iterations, Fn&& fn, int repeats = 3,
+           nlohmann::json params = nlohmann::json::object()) {
+  fn(iterations / 10 + 1);
+  double best = 0;
+  for (int i = 0; i < repeats; i++) {
+    auto start = steady_clock::now();
+    fn(iterations);
+    double ns = duration<double, std::nano>(steady_clock::now() - start).count();
+    if (i == 0 || ns < best) {
+      best = ns;
+    }
+  }
+  return {std::move(name), iterations, best / iterations, std::move(params)};
+}
+
+// keeps the compiler from dropping a computation whose result is unused
+template <typename T>
+inline void doNotOptimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+  asm volatile("" : : "r,m"(value) : "memory");
+#else
+  static volatile char sink;
+  sink = *reinterpret_cast<const volatile char*>(&value);
+#endif
+}
+
+// high-water mark of the resident set of this process, in KiB
+inline int64_t peakRssKb() {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters{};
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+    return 0;
+  }
+  return counters.PeakWorkingSetSize / 1024;
+#else
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1024;  // bytes there
+#else
+  return usage.ru_maxrss;
+#endif
+#endif
+}
+
+// one JSON document per run, so two runs can be diffed
+inline void report(const std::string& suite,
+                   const std::vector<Result>& results) {
+  nlohmann::json out;
+  out["suite"] = suite;
+  out["results"] = nlohmann::json::array();
+  for (const auto& result : results) {
+    out["results"].push_back({{"name", result.name},
+                              {"iterations", result.iterations},
+                              {"ns_per_op", result.ns_per_op},
+                              {"ops_per_sec", 1e9 / result.ns_per_op},
+                              {"params", result.params}});
+  }
+  std::cout << out.dump(2) << std::endl;
+}
+}  // namespace ArcVP::bench
+
+#endif  // BENCH_UTIL_H
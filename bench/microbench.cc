@@ -0,0 +1,346 @@
+//
+// Created by delta on 5/18/2025.
+//
+// The hot primitives one at a time: Channel under contention, FrameQueue
+// handoff, audio resampling per input format, the time-stretch, timebase
+// conversion, pixel format conversion per source format and the YUV texture
+// upload of the render loop, directly and through the texture ring.
+//
+//   arcvp_microbench [iterations]
+
+#include <spdlog/sinks/stdout_color_sinks.h>
+
+#include <cmath>
+#include <cstring>
+#include <numbers>
+#include <thread>
+
+#include "audio_resampler.h"
+#include "bench_util.h"
+#include "channel.h"
+#include "frame_queue.h"
+#include "pixel_convert.h"
+#include "texture_ring.h"
+#include "time_stretch.h"
+#include "timebase.h"
+extern "C" {
+#include <SDL3/SDL.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/samplefmt.h>
+}
+
+using namespace ArcVP;
+
+namespace {
+struct NoDelete {
+  void operator()(int64_t) const {}
+};
+
+// `producers` threads send, `consumers` threads receive, n items in total
+void channelContention(int64_t n, int producers, int consumers) {
+  Channel<int64_t, 64, NoDelete> chan;
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; p++) {
+    threads.emplace_back([&, p] {
+      for (int64_t i = p; i < n; i += producers) chan.send(i);
+    });
+  }
+  std::atomic<int64_t> sum = 0;
+  for (int c = 0; c < consumers; c++) {
+    threads.emplace_back([&, c] {
+      int64_t local = 0;
+      for (int64_t i = c; i < n; i += consumers) local += *chan.receive();
+      sum += local;
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  if (sum != n * (n - 1) / 2) std::abort();
+}
+
+void frameQueuePushPop(int64_t n) {
+  FrameQueue queue(64);
+  FrameQueue::RenderEntry entry;
+  for (int64_t i = 0; i < n; i++) {
+    queue.push({nullptr, i, 0, 4096, 40});
+    queue.tryPop(entry);
+    bench::doNotOptimize(entry);
+  }
+}
+
+void frameQueueStream(int64_t n) {
+  FrameQueue queue(16);
+  std::thread producer([&] {
+    for (int64_t i = 0; i < n; i++) queue.push({nullptr, i, 0, 4096, 40});
+  });
+  FrameQueue::RenderEntry entry;
+  for (int64_t i = 0; i < n; i++) {
+    queue.pop(entry);
+    bench::doNotOptimize(entry);
+  }
+  producer.join();
+}
+
+constexpr int kAudioSamples = 1024;
+
+bench::Result resample(AVSampleFormat format, int channels, int64_t n) {
+  AVFrame* frame = av_frame_alloc();
+  frame->format = format;
+  frame->sample_rate = 48000;
+  frame->nb_samples = kAudioSamples;
+  av_channel_layout_default(&frame->ch_layout, channels);
+  if (av_frame_get_buffer(frame, 0) < 0) {
+    spdlog::error("Unable to allocate {} audio frame",
+                  av_get_sample_fmt_name(format));
+    std::exit(1);
+  }
+  av_samples_set_silence(frame->extended_data, 0, kAudioSamples, channels,
+                         format);
+  AudioResampler resampler;
+  std::vector<uint8_t> out;
+  auto result = bench::run(
+      fmt::format("resample/{}/{}ch", av_get_sample_fmt_name(format), channels),
+      n,
+      [&](int64_t iterations) {
+        for (int64_t i = 0; i < iterations; i++) {
+          resampler.convert(frame, out);
+          bench::doNotOptimize(out.data());
+        }
+      },
+      3, {{"samples", kAudioSamples}, {"sample_rate", 48000}});
+  av_frame_free(&frame);
+  return result;
+}
+
+// one block of stereo 48kHz through the time-stretch. `core_percent` is the
+// share of one core it takes to keep up with playback.
+bench::Result stretch(double speed, int64_t n) {
+  constexpr int kRate = 48000, kChannels = 2;
+  // a few seconds of two tones, looped, so the search has something to match
+  std::vector<float> signal(size_t(kRate) * 4 * kChannels);
+  for (size_t i = 0; i < signal.size() / kChannels; i++) {
+    float v = .5f * std::sin(2 * std::numbers::pi * 220 * i / kRate) +
+              .25f * std::sin(2 * std::numbers::pi * 1375 * i / kRate);
+    signal[i * kChannels] = v;
+    signal[i * kChannels + 1] = -v;
+  }
+  TimeStretch stretcher;
+  stretcher.configure(kRate, kChannels);
+  stretcher.setSpeed(speed);
+  std::vector<float> out;
+  size_t blocks = signal.size() / (kAudioSamples * kChannels);
+  auto result = bench::run(
+      fmt::format("time_stretch/{}x", speed), n,
+      [&](int64_t iterations) {
+        for (int64_t i = 0; i < iterations; i++) {
+          out.clear();
+          stretcher.process(
+              signal.data() + (i % blocks) * kAudioSamples * kChannels,
+              kAudioSamples, out);
+          bench::doNotOptimize(out.data());
+        }
+      },
+      3,
+      {{"samples", kAudioSamples},
+       {"sample_rate", kRate},
+       {"channels", kChannels},
+       {"kernel", TimeStretch::kernelName()}});
+  double block_ns = 1e9 * kAudioSamples / kRate;
+  result.params["core_percent"] = 100 * result.ns_per_op / block_ns;
+  return result;
+}
+
+void ptsToTimeLoop(int64_t n) {
+  constexpr AVRational kTimebases[] = {{1, 90000}, {1001, 30000}, {1, 48000}};
+  int64_t sum = 0;
+  for (int64_t i = 0; i < n; i++) {
+    sum += ptsToTime(i * 3003, kTimebases[i % 3]);
+  }
+  bench::doNotOptimize(sum);
+}
+
+void timeToPtsLoop(int64_t n) {
+  constexpr AVRational kTimebases[] = {{1, 90000}, {1001, 30000}, {1, 48000}};
+  int64_t sum = 0;
+  for (int64_t i = 0; i < n; i++) {
+    sum += timeToPts(i * 33, kTimebases[i % 3]);
+  }
+  bench::doNotOptimize(sum);
+}
+
+// one 1080p picture in `format` to what its texture takes, with the fast
+// path if there is one and with swscale
+void conversions(std::vector<bench::Result>& results, AVPixelFormat format,
+                 int64_t n) {
+  constexpr int kWidth = 1920, kHeight = 1080;
+  AVFrame* in = av_frame_alloc();
+  in->format = format;
+  in->width = kWidth;
+  in->height = kHeight;
+  av_frame_get_buffer(in, 0);
+  // mid grey, any content costs the same
+  for (int plane = 0; plane < 4 && in->buf[plane]; plane++) {
+    memset(in->buf[plane]->data, 0x40, in->buf[plane]->size);
+  }
+  AVFrame* out = av_frame_alloc();
+  for (bool fast : {true, false}) {
+    PixelConverter converter;
+    converter.setOutput(PixelConverter::outputFormat(format));
+    converter.setFastPaths(fast);
+    std::string path = converter.pathName(format);
+    if (fast && path == "swscale") {
+      // no fast path for this format, the swscale run follows
+      continue;
+    }
+    bench::Result result = bench::run(
+        fmt::format("convert/{}/{}x{}/{}", av_get_pix_fmt_name(format),
+                    kWidth, kHeight, fast ? "fast" : "swscale"),
+        n, [&](int64_t iterations) {
+          for (int64_t i = 0; i < iterations; i++) {
+            converter.convert(in, out);
+            av_frame_unref(out);
+          }
+        });
+    result.params = {
+        {"output", av_get_pix_fmt_name(converter.output())},
+        {"path", path},
+        {"kernels", PixelConverter::kernelName()},
+        {"megapixels_per_s",
+         result.ns_per_op > 0 ? kWidth * kHeight * 1e3 / result.ns_per_op
+                              : 0.}};
+    results.push_back(std::move(result));
+  }
+  av_frame_free(&out);
+  av_frame_free(&in);
+}
+
+// SDL_UpdateYUVTexture into a streaming YV12 texture, as in the render loop,
+// on the software renderer so the numbers do not depend on a GPU driver
+void uploads(std::vector<bench::Result>& results, int64_t n) {
+  if (!SDL_Init(SDL_INIT_VIDEO)) {
+    // no display, the offscreen driver still has a software renderer
+    SDL_SetHint(SDL_HINT_VIDEO_DRIVER, "offscreen");
+    if (!SDL_Init(SDL_INIT_VIDEO)) {
+      spdlog::warn("Skipping upload benchmarks: {}", SDL_GetError());
+      return;
+    }
+  }
+  SDL_Window* window = SDL_CreateWindow("arcvp_microbench", 64, 64,
+                                        SDL_WINDOW_HIDDEN);
+  SDL_Renderer* renderer =
+      window ? SDL_CreateRenderer(window, SDL_SOFTWARE_RENDERER) : nullptr;
+  if (!renderer) {
+    spdlog::warn("Skipping upload benchmarks: {}", SDL_GetError());
+    if (window) SDL_DestroyWindow(window);
+    SDL_Quit();
+    return;
+  }
+  constexpr std::pair<int, int> kSizes[] = {{1280, 720}, {1920, 1080}};
+  for (auto [width, height] : kSizes) {
+    AVFrame* frame = av_frame_alloc();
+    frame->format = AV_PIX_FMT_YUV420P;
+    frame->width = width;
+    frame->height = height;
+    av_frame_get_buffer(frame, 0);
+    SDL_Texture* texture =
+        SDL_CreateTexture(renderer, SDL_PIXELFORMAT_YV12,
+                          SDL_TEXTUREACCESS_STREAMING, width, height);
+    results.push_back(bench::run(
+        fmt::format("upload/yuv420p/{}x{}", width, height), n,
+        [&](int64_t iterations) {
+          for (int64_t i = 0; i < iterations; i++) {
+            SDL_UpdateYUVTexture(texture, nullptr, frame->data[0],
+                                 frame->linesize[0], frame->data[1],
+                                 frame->linesize[1], frame->data[2],
+                                 frame->linesize[2]);
+          }
+        },
+        3,
+        {{"renderer", SDL_GetRendererName(renderer)},
+         {"bytes", av_image_get_buffer_size(AV_PIX_FMT_YUV420P, width,
+                                            height, 1)}}));
+    SDL_DestroyTexture(texture);
+    // what the render thread pays per frame with the copy on the upload
+    // thread, and how often it still had to upload itself
+    for (int depth : {2, 3}) {
+      TextureRing ring;
+      LatencyRecorder upload_times;
+      if (!ring.create(renderer, width, height, AV_PIX_FMT_YUV420P, depth,
+                       [](AVFrame*) {}, SDL_EVENT_USER, &upload_times)) {
+        continue;
+      }
+      int64_t frames = 0, sync_uploads = 0;
+      bench::Result result = bench::run(
+          fmt::format("upload/ring{}/{}x{}", depth, width, height), n,
+          [&](int64_t iterations) {
+            for (int64_t i = 0; i < iterations; i++, frames++) {
+              if (!ring.submit(frame)) {
+                sync_uploads++;
+                ring.uploadNow(frame);
+              }
+              ring.collect();
+              SDL_FlushEvent(SDL_EVENT_USER);
+            }
+          });
+      ring.destroy();
+      result.params = {{"renderer", SDL_GetRendererName(renderer)},
+                       {"depth", depth},
+                       {"upload_mean_us", upload_times.mean()},
+                       {"sync_upload_percent", 100. * sync_uploads / frames}};
+      results.push_back(std::move(result));
+    }
+    av_frame_free(&frame);
+  }
+  SDL_DestroyRenderer(renderer);
+  SDL_DestroyWindow(window);
+  SDL_Quit();
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  int64_t n = argc > 1 ? std::stoll(argv[1]) : 1'000'000;
+  spdlog::set_default_logger(spdlog::stderr_color_mt("arcvp_microbench"));
+
+  std::vector<bench::Result> results;
+  for (auto [producers, consumers] : {std::pair{1, 1}, {2, 2}, {4, 4}}) {
+    results.push_back(bench::run(
+        fmt::format("channel/{}p{}c", producers, consumers), n / 4,
+        [=](int64_t iterations) {
+          channelContention(iterations, producers, consumers);
+        },
+        3, {{"capacity", 64}}));
+  }
+  results.push_back(
+      bench::run("frame_queue/push_pop", n, frameQueuePushPop));
+  results.push_back(bench::run("frame_queue/stream", n / 4, frameQueueStream,
+                               3, {{"capacity", 16}}));
+
+  for (AVSampleFormat format :
+       {AV_SAMPLE_FMT_U8, AV_SAMPLE_FMT_S16, AV_SAMPLE_FMT_S32,
+        AV_SAMPLE_FMT_FLT, AV_SAMPLE_FMT_DBL, AV_SAMPLE_FMT_U8P,
+        AV_SAMPLE_FMT_S16P, AV_SAMPLE_FMT_S32P, AV_SAMPLE_FMT_FLTP,
+        AV_SAMPLE_FMT_DBLP}) {
+    for (int channels : {1, 2, 6}) {
+      results.push_back(resample(format, channels, n / 1000));
+    }
+  }
+
+  for (double speed : {0.5, 0.75, 1.25, 1.5, 2.0}) {
+    results.push_back(stretch(speed, n / 1000));
+  }
+
+  results.push_back(bench::run("timebase/ptsToTime", n * 10, ptsToTimeLoop));
+  results.push_back(bench::run("timebase/timeToPts", n * 10, timeToPtsLoop));
+
+  for (AVPixelFormat format :
+       {AV_PIX_FMT_P010LE, AV_PIX_FMT_YUV420P10LE, AV_PIX_FMT_YUV422P,
+        AV_PIX_FMT_YUVJ422P, AV_PIX_FMT_YUV444P, AV_PIX_FMT_NV21}) {
+    conversions(results, format, n / 10000);
+  }
+
+  uploads(results, n / 10000);
+
+  bench::report("microbench", results);
+  return 0;
+}
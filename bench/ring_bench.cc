@@ -0,0 +1,80 @@
+//
+// Created by delta on 5/13/2025.
+//
+// SpscRing against the mutex/semaphore Channel it replaced, for the two
+// handoff patterns of the pipeline: a producer and a consumer thread streaming
+// items through a small queue, and a single thread pushing and popping.
+
+#include <thread>
+
+#include "bench_util.h"
+#include "channel.h"
+#include "spsc_ring.h"
+
+using namespace ArcVP;
+
+namespace {
+constexpr size_t kCapacity = 128;
+
+struct NoDelete {
+  void operator()(int64_t) const {}
+};
+
+void ringStream(int64_t n) {
+  SpscRing<int64_t> ring(kCapacity);
+  std::thread producer([&] {
+    for (int64_t i = 0; i < n; i++) ring.push(i);
+  });
+  int64_t value = 0, sum = 0;
+  for (int64_t i = 0; i < n; i++) {
+    ring.pop(value);
+    sum += value;
+  }
+  producer.join();
+  if (sum != n * (n - 1) / 2) std::abort();
+}
+
+void channelStream(int64_t n) {
+  Channel<int64_t, kCapacity, NoDelete> chan;
+  std::thread producer([&] {
+    for (int64_t i = 0; i < n; i++) chan.send(i);
+  });
+  int64_t sum = 0;
+  for (int64_t i = 0; i < n; i++) {
+    sum += *chan.receive();
+  }
+  producer.join();
+  if (sum != n * (n - 1) / 2) std::abort();
+}
+
+void ringPingPong(int64_t n) {
+  SpscRing<int64_t> ring(kCapacity);
+  int64_t value = 0;
+  for (int64_t i = 0; i < n; i++) {
+    ring.tryPush(i);
+    ring.tryPop(value);
+  }
+}
+
+void channelPingPong(int64_t n) {
+  Channel<int64_t, kCapacity, NoDelete> chan;
+  for (int64_t i = 0; i < n; i++) {
+    chan.send(i);
+    chan.receive();
+  }
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  int64_t n = argc > 1 ? std::stoll(argv[1]) : 1'000'000;
+  nlohmann::json params = {{"capacity", kCapacity}};
+  std::vector<bench::Result> results;
+  results.push_back(bench::run("spsc_ring/stream", n, ringStream, 3, params));
+  results.push_back(bench::run("channel/stream", n, channelStream, 3, params));
+  results.push_back(
+      bench::run("spsc_ring/push_pop", n, ringPingPong, 3, params));
+  results.push_back(
+      bench::run("channel/send_receive", n, channelPingPong, 3, params));
+  bench::report("ring_bench", results);
+  return 0;
+}
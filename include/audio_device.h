@@ -8,10 +8,23 @@ extern "C" {
 }
 namespace ArcVP {
 
+// How much audio is buffered between the decoder and the speakers. Half of it
+// is the device period, the other half decoded samples waiting in the PcmRing.
+struct AudioOutputConfig {
+  static constexpr int kMinLatencyMs = 20;
+  static constexpr int kMaxLatencyMs = 200;
+  int target_latency_ms = 60;
+  // change the speed with a time-stretch instead of resampling, which would
+  // shift the pitch along with it
+  bool preserve_pitch = true;
+};
+
 struct AudioDevice {
   SDL_AudioDeviceID id = -1;
   const char* name = nullptr;
   SDL_AudioSpec spec{};
+  // device buffer size in sample frames at spec.freq
+  int sample_frames = 0;
 
 
   ~AudioDevice() {
@@ -0,0 +1,53 @@
+//
+// Created by delta on 5/18/2025.
+//
+
+#ifndef AUDIO_RESAMPLER_H
+#define AUDIO_RESAMPLER_H
+extern "C" {
+#include <libavutil/channel_layout.h>
+#include <libavutil/frame.h>
+#include <libavutil/samplefmt.h>
+#include <libswresample/swresample.h>
+}
+
+#include <cstdint>
+#include <vector>
+
+namespace ArcVP {
+
+// Converts decoded audio to interleaved float, the format the SDL audio
+// stream is fed with. Without setOutput the frame's own rate and channel
+// layout are kept. The SwrContext is set up on the first frame and again
+// whenever the input format changes.
+class AudioResampler {
+  SwrContext* ctx_ = nullptr;
+  AVSampleFormat in_format_ = AV_SAMPLE_FMT_NONE;
+  int in_rate_ = 0;
+  AVChannelLayout in_layout_{};
+  int out_rate_ = 0;
+  AVChannelLayout out_layout_{};
+
+  bool setup(const AVFrame* frame);
+
+ public:
+  AudioResampler() = default;
+  AudioResampler(const AudioResampler&) = delete;
+  AudioResampler& operator=(const AudioResampler&) = delete;
+  ~AudioResampler() {
+    reset();
+    av_channel_layout_uninit(&out_layout_);
+  }
+
+  // converts to this rate and layout from now on, whatever the input is
+  void setOutput(int rate, const AVChannelLayout& layout);
+
+  // converts `frame` into `out`, which is resized to the converted samples.
+  // Returns the number of samples per channel, or a negative AVERROR.
+  int convert(const AVFrame* frame, std::vector<uint8_t>& out);
+
+  void reset();
+};
+}  // namespace ArcVP
+
+#endif  // AUDIO_RESAMPLER_H
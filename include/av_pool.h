@@ -0,0 +1,89 @@
+//
+// Created by delta on 5/14/2025.
+//
+
+#ifndef AV_POOL_H
+#define AV_POOL_H
+extern "C" {
+#include <libavcodec/packet.h>
+#include <libavutil/frame.h>
+}
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace ArcVP {
+
+// Free list of AVFrame/AVPacket shells. Released objects are unref'd, which
+// hands their data buffers back to whoever owns them, and kept for the next
+// acquire instead of being freed.
+template <typename T, T* (*Alloc)(), void (*Free)(T**), void (*Unref)(T*)>
+class AVObjectPool {
+  std::vector<T*> free_;
+  std::mutex mtx_;
+  size_t max_idle_;
+  std::atomic<int64_t> hits_ = 0, misses_ = 0;
+
+ public:
+  explicit AVObjectPool(size_t max_idle = 256) : max_idle_(max_idle) {
+    free_.reserve(max_idle);
+  }
+
+  AVObjectPool(const AVObjectPool&) = delete;
+  AVObjectPool& operator=(const AVObjectPool&) = delete;
+
+  // nullptr only if a fresh allocation fails
+  T* acquire() {
+    {
+      std::scoped_lock lk{mtx_};
+      if (!free_.empty()) {
+        T* obj = free_.back();
+        free_.pop_back();
+        hits_.fetch_add(1, std::memory_order_relaxed);
+        return obj;
+      }
+    }
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return Alloc();
+  }
+
+  void release(T* obj) {
+    if (!obj) {
+      return;
+    }
+    Unref(obj);
+    {
+      std::scoped_lock lk{mtx_};
+      if (free_.size() < max_idle_) {
+        free_.push_back(obj);
+        return;
+      }
+    }
+    Free(&obj);
+  }
+
+  int64_t hits() const { return hits_.load(std::memory_order_relaxed); }
+
+  int64_t misses() const { return misses_.load(std::memory_order_relaxed); }
+
+  size_t idle() {
+    std::scoped_lock lk{mtx_};
+    return free_.size();
+  }
+
+  ~AVObjectPool() {
+    for (T* obj : free_) {
+      Free(&obj);
+    }
+  }
+};
+
+using FramePool =
+    AVObjectPool<AVFrame, av_frame_alloc, av_frame_free, av_frame_unref>;
+using PacketPool =
+    AVObjectPool<AVPacket, av_packet_alloc, av_packet_free, av_packet_unref>;
+}  // namespace ArcVP
+
+#endif  // AV_POOL_H
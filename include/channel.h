@@ -5,6 +5,10 @@
 #ifndef CHANNEL_H
 #define CHANNEL_H
 
+#include <spdlog/spdlog.h>
+
+#include <atomic>
+#include <cassert>
 #include <deque>
 #include <mutex>
 #include <optional>
@@ -0,0 +1,62 @@
+//
+// Created by delta on 5/19/2025.
+//
+
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+#define ARCVP_X86 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include <immintrin.h>
+#endif
+
+// Functions using AVX2 intrinsics are built with this attribute, so the rest
+// of the tree does not need -mavx2 and runs on any x86 CPU. MSVC accepts the
+// intrinsics without it.
+#if defined(ARCVP_X86) && (defined(__GNUC__) || defined(__clang__))
+#define ARCVP_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define ARCVP_TARGET_AVX2
+#endif
+
+namespace ArcVP {
+
+// What the SIMD kernels may use on this machine, checked once at runtime.
+struct CpuFeatures {
+  bool sse2 = false;
+  bool avx2 = false;
+
+  static const CpuFeatures& get() {
+    static const CpuFeatures features = detect();
+    return features;
+  }
+
+ private:
+  static CpuFeatures detect() {
+    CpuFeatures features;
+#if defined(ARCVP_X86) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    features.sse2 = __builtin_cpu_supports("sse2");
+    features.avx2 = __builtin_cpu_supports("avx2") &&
+                    __builtin_cpu_supports("fma");
+#elif defined(ARCVP_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    features.sse2 = info[3] & (1 << 26);
+    bool fma = info[2] & (1 << 12);
+    // the OS has to save the YMM registers too
+    bool osxsave = info[2] & (1 << 27);
+    bool ymm = osxsave && (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    features.avx2 = fma && ymm && (info[1] & (1 << 5));
+#endif
+    return features;
+  }
+};
+}  // namespace ArcVP
+
+#endif  // CPU_FEATURES_H
@@ -6,25 +6,71 @@
 #define DECODE_WORKER_H
 extern "C"{
 #include <libavcodec/packet.h>
+#include <libavutil/avutil.h>
 }
 
+#include <atomic>
 #include <memory>
 #include <thread>
 
 #include "frame_queue.h"
+#include "packet_queue.h"
+#include "pipeline_stats.h"
 #include "player.h"
 enum class WorkerStatus { Working, Idle, Exiting };
 namespace ArcVP {
+// Threading of the video decoder, applied when a file is opened.
+struct DecodeThreadConfig {
+  // 0 picks one thread per core, up to max_threads
+  int thread_count = 0;
+  int max_threads = 16;
+  bool frame_threads = true;
+  bool slice_threads = true;
+};
+
 struct DecodeWorker {
   std::unique_ptr<std::thread> th = nullptr;
   std::mutex mtx{};
   std::condition_variable cv;
   FrameQueue output_queue;
 
-  std::deque<AVPacket*> packet_chan{};
+  PacketQueue packet_chan{};
   WorkerStatus status = WorkerStatus::Idle;
+  // Where the demuxer went for a seek, published before the first packet
+  // read after it.
+  struct SeekTarget {
+    int serial = 0;
+    int64_t preroll_ms = AV_NOPTS_VALUE;
+    // nowUs() of the request, 0 on the workers we do not present from
+    int64_t requested_us = 0;
+  };
+
+  // serial of the latest seek, set by seekTo. Frames of another serial are
+  // dropped.
+  std::atomic_int serial = 0;
+  // serial of the packets the codec is working on, decode thread only
+  int codec_serial = 0;
+  // frames before this are decoded but not output, decode thread only
+  int64_t preroll_ms = AV_NOPTS_VALUE;
+  // until the first frame at the target is out, decode thread only
+  int64_t seek_started_us = 0;
+  std::mutex seek_mtx{};
+  SeekTarget seek_target{};
+  RateMeter decode_rate{};
+
+  // sized by FrameQueue::configure once the stream is open. The audio worker
+  // writes to the PcmRing and never uses its queue.
+  explicit DecodeWorker() : output_queue(QueueBudget{}.min_frames) {}
 
-  explicit DecodeWorker() :output_queue(100){}
+  void setSeekTarget(const SeekTarget& target) {
+    std::scoped_lock lk{seek_mtx};
+    seek_target = target;
+  }
+
+  SeekTarget seekTarget() {
+    std::scoped_lock lk{seek_mtx};
+    return seek_target;
+  }
 
   template <typename Fn, typename... Args>
   void spawn(Fn&& func, Args&&... args) {
@@ -0,0 +1,173 @@
+//
+// Created by delta on 5/22/2025.
+//
+
+#ifndef DEGRADATION_H
+#define DEGRADATION_H
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+namespace ArcVP {
+
+// How much decoding work the video decoder may skip, each level includes the
+// ones before it.
+enum class DegradationLevel : int {
+  None,
+  SkipLoopFilter,  // no deblocking, slightly blocky
+  SkipNonRef,      // non-reference frames are not decoded at all
+  KeyframesOnly,
+};
+
+inline const char* degradationLevelName(DegradationLevel level) {
+  switch (level) {
+    case DegradationLevel::None:
+      return "none";
+    case DegradationLevel::SkipLoopFilter:
+      return "skip loop filter";
+    case DegradationLevel::SkipNonRef:
+      return "skip non-ref frames";
+    case DegradationLevel::KeyframesOnly:
+      return "keyframes only";
+  }
+  return "unknown";
+}
+
+// Fast-forward decodes less per media second the faster it goes: past 2x the
+// non-reference frames are skipped, past 4x everything but keyframes.
+inline DegradationLevel fastForwardLevel(float speed) {
+  if (speed > 4) {
+    return DegradationLevel::KeyframesOnly;
+  }
+  if (speed > 2) {
+    return DegradationLevel::SkipNonRef;
+  }
+  return DegradationLevel::None;
+}
+
+struct DegradationConfig {
+  bool enabled = true;
+  // a frame counts as late when presented this much after its time
+  int64_t late_ms = 40;
+  int64_t window_ms = 500;
+  // share of late frames in a window that escalates one level, if the video
+  // queue is also draining: it ended the window emptier than it started it or
+  // below `low_fill`. Late frames with a full queue are not the decoder's
+  // fault and skipping decode work would not help.
+  double escalate_ratio = .25;
+  double low_fill = .25;
+  // steps down only happen at or above this fill, the decoder has headroom
+  double healthy_fill = .5;
+  // windows without late frames before stepping down one level, doubled each
+  // time the step down turns out to be too early
+  int recover_windows = 4;
+  int max_recover_windows = 64;
+};
+
+// Watches how late the presented frames are and how full the video queue is,
+// and tells the video decoder how much work to skip, so an overloaded CPU
+// decodes fewer frames instead of decoding all of them and dropping most.
+//
+// observe() is called by the thread presenting frames, level() is read by the
+// decode thread, which applies it to its codec context.
+class DegradationController {
+  DegradationConfig config_{};
+  std::atomic_int level_ = 0;
+
+  // presenting thread only
+  int64_t window_start_us_ = 0;
+  int frames_ = 0, late_ = 0;
+  double start_fill_ = 0;
+  int calm_windows_ = 0;
+  int recover_windows_ = config_.recover_windows;
+  // the last change was a step down, escalating right away means it was
+  // premature
+  bool recovering_ = false;
+
+  void setLevel(int level) {
+    level_.store(std::clamp(level, 0, int(DegradationLevel::KeyframesOnly)),
+                 std::memory_order_relaxed);
+  }
+
+ public:
+  void configure(const DegradationConfig& config) {
+    config_ = config;
+    recover_windows_ = config.recover_windows;
+    if (!config.enabled) {
+      setLevel(0);
+    }
+  }
+
+  const DegradationConfig& config() const { return config_; }
+
+  DegradationLevel level() const {
+    return static_cast<DegradationLevel>(
+        level_.load(std::memory_order_relaxed));
+  }
+
+  // `lateness_ms` of a frame that was just presented or dropped, and the
+  // `queue_fill` of the video queue after taking it, 0 to 1
+  void observe(int64_t lateness_ms, double queue_fill, int64_t now_us) {
+    if (!config_.enabled) {
+      return;
+    }
+    if (frames_ == 0) {
+      window_start_us_ = now_us;
+      start_fill_ = queue_fill;
+    }
+    frames_++;
+    if (lateness_ms > config_.late_ms) {
+      late_++;
+    }
+    if (now_us - window_start_us_ < config_.window_ms * 1000) {
+      return;
+    }
+    int level = level_.load(std::memory_order_relaxed);
+    bool draining = queue_fill < start_fill_ || queue_fill < config_.low_fill;
+    bool healthy = queue_fill >= config_.healthy_fill;
+    if (late_ >= frames_ * config_.escalate_ratio && draining) {
+      if (recovering_) {
+        recover_windows_ =
+            std::min(recover_windows_ * 2, config_.max_recover_windows);
+      }
+      setLevel(level + 1);
+      recovering_ = false;
+      calm_windows_ = 0;
+    } else if (late_ == 0 && healthy) {
+      if (++calm_windows_ >= recover_windows_) {
+        calm_windows_ = 0;
+        if (level > 0) {
+          setLevel(level - 1);
+          recovering_ = true;
+        } else {
+          // stable at full quality, be quick to recover next time
+          recover_windows_ = config_.recover_windows;
+          recovering_ = false;
+        }
+      }
+    } else {
+      calm_windows_ = 0;
+    }
+    frames_ = late_ = 0;
+  }
+
+  // lateness right after a seek or unpause says nothing about load
+  void resetWindow() { frames_ = late_ = 0; }
+
+  static void apply(AVCodecContext* ctx, DegradationLevel level) {
+    ctx->skip_loop_filter = level >= DegradationLevel::SkipLoopFilter
+                                ? AVDISCARD_ALL
+                                : AVDISCARD_DEFAULT;
+    ctx->skip_frame =
+        level >= DegradationLevel::KeyframesOnly ? AVDISCARD_NONKEY
+        : level >= DegradationLevel::SkipNonRef  ? AVDISCARD_NONREF
+                                                 : AVDISCARD_DEFAULT;
+  }
+};
+}  // namespace ArcVP
+
+#endif  // DEGRADATION_H
@@ -0,0 +1,46 @@
+//
+// Created by delta on 5/10/2025.
+//
+
+#ifndef DEMUX_WORKER_H
+#define DEMUX_WORKER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "decode_worker.h"
+#include "packet_queue.h"
+namespace ArcVP {
+struct DemuxWorker {
+  std::unique_ptr<std::thread> th = nullptr;
+  std::mutex mtx{};
+  std::condition_variable cv;
+  ReadAheadLimits limits{};
+  // bumped by every seek, written while holding MediaContext::format_mtx_
+  std::atomic_int serial = 0;
+  WorkerStatus status = WorkerStatus::Idle;
+
+  template <typename Fn, typename... Args>
+  void spawn(Fn&& func, Args&&... args) {
+    status = WorkerStatus::Working;
+    th = std::make_unique<std::thread>(std::forward<Fn>(func),
+                                       std::forward<Args>(args)...);
+  }
+
+  // after changing anything the demux thread waits on. Taking the mutex
+  // orders the change before its next predicate check, so the wakeup can not
+  // fall between that check and the wait.
+  void wake() {
+    { std::scoped_lock lk{mtx}; }
+    cv.notify_all();
+  }
+
+  void join() const {
+    if (th && th->joinable()) th->join();
+  }
+};
+}  // namespace ArcVP
+#endif  // DEMUX_WORKER_H
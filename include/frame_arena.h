@@ -0,0 +1,88 @@
+//
+// Created by delta on 5/15/2025.
+//
+
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace ArcVP {
+
+// Picture buffers for one (width, height, pixel format), installed as the
+// video decoder's get_buffer2. Every block holds a whole picture with 64-byte
+// aligned planes and goes back to the free list when the decoder and the
+// renderer drop their last reference, so steady-state decoding does no large
+// allocations at all.
+//
+// The arena is reference counted by hand: the owner holds one reference and
+// every buffer handed out holds another, so a retired arena stays alive until
+// the last frame decoded into it is released.
+class FrameArena {
+  int width_, height_;
+  AVPixelFormat format_;
+  // what the blocks are laid out for, after the codec's alignment
+  int aligned_width_ = 0, aligned_height_ = 0;
+  int linesize_[4] = {};
+  ptrdiff_t plane_offset_[4] = {-1, -1, -1, -1};
+  size_t block_size_ = 0;
+
+  std::vector<uint8_t*> blocks_;
+  std::vector<uint8_t*> free_;
+  std::mutex mtx_;
+  std::atomic_int refs_ = 1;
+  std::atomic<int64_t> reuses_ = 0;
+
+  FrameArena(int width, int height, AVPixelFormat format)
+      : width_(width), height_(height), format_(format) {}
+  ~FrameArena();
+
+  bool layout(AVCodecContext* ctx);
+  uint8_t* takeBlock();
+  int fill(AVFrame* frame);
+  void unref();
+  static void freeBuffer(void* opaque, uint8_t* data);
+
+ public:
+  // nullptr if the codec or pixel format can not decode into an arena
+  static FrameArena* create(AVCodecContext* ctx, int prealloc = 4);
+
+  // the get_buffer2 callback, expects the arena in AVCodecContext::opaque
+  static int getBuffer2(AVCodecContext* ctx, AVFrame* frame, int flags);
+
+  bool matches(int width, int height, AVPixelFormat format) const {
+    return width == width_ && height == height_ && format == format_;
+  }
+
+  // installs the arena on a codec context that has not been opened yet
+  void attach(AVCodecContext* ctx) {
+    ctx->opaque = this;
+    ctx->get_buffer2 = &FrameArena::getBuffer2;
+  }
+
+  // drops the owner's reference
+  void retire() { unref(); }
+
+  size_t blocks() {
+    std::scoped_lock lk{mtx_};
+    return blocks_.size();
+  }
+
+  size_t idle() {
+    std::scoped_lock lk{mtx_};
+    return free_.size();
+  }
+
+  int64_t reuses() const { return reuses_; }
+
+  size_t blockSize() const { return block_size_; }
+};
+}  // namespace ArcVP
+
+#endif  // FRAME_ARENA_H
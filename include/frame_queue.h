@@ -5,31 +5,139 @@
 #ifndef FRAME_QUEUE_H
 #define FRAME_QUEUE_H
 extern "C" {
+#include <libavutil/avutil.h>
 #include <libavutil/frame.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/samplefmt.h>
 }
 
-#include "player.h"
+#include <algorithm>
+#include <atomic>
+
+#include "av_pool.h"
+#include "spsc_ring.h"
 namespace ArcVP {
+
+// How many decoded frames the video queue may hold: as many as cover
+// `target_ms`, but never more than `video_max_bytes` worth of them. Decoded
+// audio goes to the PcmRing instead, whose budget is
+// AudioOutputConfig::target_latency_ms.
+struct QueueBudget {
+  int64_t video_max_bytes = 256 * 1024 * 1024;
+  int64_t target_ms = 1000;
+  int min_frames = 3;
+  int max_frames = 1024;
+};
+
+// Decoder -> renderer queue. The decode thread is the only producer, the
+// thread presenting frames is the only consumer.
 struct FrameQueue {
   struct RenderEntry {
-    AVFrame* frame;
-    int64_t present_ms;
+    AVFrame* frame = nullptr;
+    int64_t present_ms = AV_NOPTS_VALUE;
+    // DecodeWorker::serial at decode time, entries of an older serial were
+    // decoded before a seek
+    int serial = 0;
+    int64_t bytes = 0;
+    int64_t duration_ms = 0;
+    // steady_clock time of the push in microseconds, for queue latency
+    int64_t queued_us = 0;
   };
-  std::deque<RenderEntry> queue;
-  std::mutex mtx;
-  std::counting_semaphore<> semReady, semEmpty;
-
-  explicit FrameQueue(int size) : semReady(0), semEmpty(size) {}
-
-  void clear() {
-    std::scoped_lock lk{mtx};
-    while (!queue.empty()) {
-      semReady.acquire();
-      av_frame_free(&queue.front().frame);
-      queue.pop_front();
-      semEmpty.release();
+  SpscRing<RenderEntry> ring;
+  std::atomic<int64_t> bytes = 0;
+  std::atomic<int64_t> duration_ms = 0;
+  // for frames that do not carry a duration
+  int64_t default_duration_ms = 0;
+
+  explicit FrameQueue(int size) : ring(size) {}
+
+  // depth from the frame size and rate of the opened stream, only valid
+  // before the decode thread starts
+  int64_t configure(int64_t frame_bytes, double frames_per_second,
+                    int64_t max_bytes, const QueueBudget& budget) {
+    int64_t by_bytes = frame_bytes > 0 ? max_bytes / frame_bytes
+                                       : budget.max_frames;
+    int64_t by_duration = frames_per_second > 0
+                              ? budget.target_ms * frames_per_second / 1000 + 1
+                              : budget.max_frames;
+    int64_t depth = std::clamp<int64_t>(std::min(by_bytes, by_duration),
+                                        budget.min_frames, budget.max_frames);
+    ring.reset(depth);
+    default_duration_ms =
+        frames_per_second > 0 ? 1000 / frames_per_second : 0;
+    return depth;
+  }
+
+  static int64_t frameBytes(const AVFrame* frame) {
+    if (frame->nb_samples > 0) {
+      return av_samples_get_buffer_size(
+          nullptr, frame->ch_layout.nb_channels, frame->nb_samples,
+          static_cast<AVSampleFormat>(frame->format), 1);
+    }
+    return av_image_get_buffer_size(static_cast<AVPixelFormat>(frame->format),
+                                    frame->width, frame->height, 1);
+  }
+
+  // producer side
+  bool push(const RenderEntry& entry) {
+    bytes += entry.bytes;
+    duration_ms += entry.duration_ms;
+    if (!ring.push(entry)) {
+      bytes -= entry.bytes;
+      duration_ms -= entry.duration_ms;
+      return false;
+    }
+    return true;
+  }
+
+  // consumer side
+  RenderEntry* front() { return ring.front(); }
+
+  bool tryPop(RenderEntry& entry) {
+    if (!ring.tryPop(entry)) {
+      return false;
+    }
+    bytes -= entry.bytes;
+    duration_ms -= entry.duration_ms;
+    return true;
+  }
+
+  // blocks until an entry is available, false once the queue is closed
+  bool pop(RenderEntry& entry) {
+    if (!ring.pop(entry)) {
+      return false;
+    }
+    bytes -= entry.bytes;
+    duration_ms -= entry.duration_ms;
+    return true;
+  }
+
+  void clear(FramePool& pool) {
+    RenderEntry entry;
+    while (tryPop(entry)) {
+      pool.release(entry.frame);
     }
   }
+
+  void close() { ring.close(); }
+
+  // empty and open again after close(), only once neither side uses it
+  void reset(FramePool& pool) {
+    clear(pool);
+    ring.reset(ring.capacity());
+    bytes = 0;
+    duration_ms = 0;
+  }
+
+  size_t size() const { return ring.size(); }
+
+  size_t capacity() const { return ring.capacity(); }
+
+  // share of the depth in use, 0 to 1
+  double fill() const {
+    size_t depth = capacity();
+    return depth > 0 ? double(size()) / depth : 0;
+  }
 };
 }  // namespace ArcVP
 
@@ -0,0 +1,59 @@
+//
+// Created by delta on 5/12/2025.
+//
+
+#ifndef INDEX_CACHE_H
+#define INDEX_CACHE_H
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+#include "keyframe_index.h"
+
+namespace ArcVP {
+
+// Sidecar file holding the keyframe index of a media file, so reopening the
+// same recording does not need another pass over it. The layout is plain
+// little-endian POD, so loading maps the file and copies the entries of each
+// stream straight into the KeyframeIndex, without parsing:
+//
+//   IndexCacheHeader
+//   IndexCacheStream[nb_streams]
+//   media path bytes (path_size, padded to 8)
+//   KeyframeEntry[...]
+//
+// A cache is only used if the path, size and mtime of the media file match.
+struct IndexCacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t nb_streams;
+  uint64_t file_size;
+  int64_t mtime;
+  uint64_t path_size;
+  uint64_t path_offset;
+  uint64_t entries_offset;
+};
+
+struct IndexCacheStream {
+  uint64_t first_entry;
+  uint64_t entry_count;
+};
+
+inline constexpr char kIndexCacheMagic[8] = {'A', 'R', 'C', 'V',
+                                             'P', 'I', 'D', 'X'};
+inline constexpr uint32_t kIndexCacheVersion = 1;
+
+std::filesystem::path indexCachePath(const std::string& filename);
+
+// whether the file has a cache that is not stale, without reading the index.
+// Tells open() the file was seen before, so probing it can be cut short.
+bool hasIndexCache(const std::string& filename);
+
+// returns false if there is no cache for the file or it is stale
+bool loadIndexCache(const std::string& filename, KeyframeIndex& index);
+
+bool saveIndexCache(const std::string& filename, KeyframeIndex& index);
+}  // namespace ArcVP
+
+#endif  // INDEX_CACHE_H
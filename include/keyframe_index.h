@@ -0,0 +1,130 @@
+//
+// Created by delta on 5/11/2025.
+//
+
+#ifndef KEYFRAME_INDEX_H
+#define KEYFRAME_INDEX_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace ArcVP {
+
+struct KeyframeEntry {
+  int64_t pts;           // in stream time base
+  int64_t pos;           // byte position of the packet, -1 if unknown
+  int64_t packet_index;  // ordinal of the packet within its stream
+};
+
+// Per-stream list of keyframes, sorted by pts. Filled by a background pass
+// over the file, lookups are allowed while it is still being built.
+class KeyframeIndex {
+  std::vector<std::vector<KeyframeEntry>> streams_;
+  std::mutex mtx_;
+  std::atomic_bool complete_ = false;
+
+  // with mtx_ held
+  bool validIndex(int stream_index) const {
+    return stream_index >= 0 && size_t(stream_index) < streams_.size();
+  }
+
+ public:
+  void reset(int nb_streams) {
+    std::scoped_lock lk{mtx_};
+    streams_.assign(nb_streams, {});
+    complete_ = false;
+  }
+
+  void add(int stream_index, const KeyframeEntry& entry) {
+    std::scoped_lock lk{mtx_};
+    if (!validIndex(stream_index)) {
+      return;
+    }
+    auto& entries = streams_[stream_index];
+    // packets come in dts order, keyframe pts is monotonic in practice but
+    // keep the list sorted in case it is not
+    auto it = std::upper_bound(
+        entries.begin(), entries.end(), entry.pts,
+        [](int64_t pts, const KeyframeEntry& e) { return pts < e.pts; });
+    entries.insert(it, entry);
+  }
+
+  void markComplete() { complete_ = true; }
+
+  bool complete() const { return complete_; }
+
+  // last keyframe with pts <= `pts`. Returns nothing if the part of the file
+  // holding `pts` has not been indexed yet, an earlier keyframe would make the
+  // seek decode more than one GOP.
+  std::optional<KeyframeEntry> floor(int stream_index, int64_t pts) {
+    std::scoped_lock lk{mtx_};
+    if (!validIndex(stream_index)) {
+      return std::nullopt;
+    }
+    const auto& entries = streams_[stream_index];
+    if (entries.empty() || (!complete_ && pts > entries.back().pts)) {
+      return std::nullopt;
+    }
+    auto it = std::upper_bound(
+        entries.begin(), entries.end(), pts,
+        [](int64_t pts, const KeyframeEntry& e) { return pts < e.pts; });
+    if (it == entries.begin()) {
+      return entries.front();
+    }
+    return *std::prev(it);
+  }
+
+  // first keyframe with pts >= `pts`. Returns nothing if there is none, or
+  // if the part of the file after `pts` has not been indexed yet.
+  std::optional<KeyframeEntry> ceil(int stream_index, int64_t pts) {
+    std::scoped_lock lk{mtx_};
+    if (!validIndex(stream_index)) {
+      return std::nullopt;
+    }
+    const auto& entries = streams_[stream_index];
+    auto it = std::lower_bound(
+        entries.begin(), entries.end(), pts,
+        [](const KeyframeEntry& e, int64_t pts) { return e.pts < pts; });
+    if (it == entries.end()) {
+      return std::nullopt;
+    }
+    return *it;
+  }
+
+  int streamCount() {
+    std::scoped_lock lk{mtx_};
+    return streams_.size();
+  }
+
+  std::vector<KeyframeEntry> entries(int stream_index) {
+    std::scoped_lock lk{mtx_};
+    if (!validIndex(stream_index)) {
+      return {};
+    }
+    return streams_[stream_index];
+  }
+
+  // replaces the entries of a stream with an already sorted list
+  void assign(int stream_index, const KeyframeEntry* entries, size_t count) {
+    std::scoped_lock lk{mtx_};
+    if (!validIndex(stream_index)) {
+      return;
+    }
+    streams_[stream_index].assign(entries, entries + count);
+  }
+
+  size_t size(int stream_index) {
+    std::scoped_lock lk{mtx_};
+    if (!validIndex(stream_index)) {
+      return 0;
+    }
+    return streams_[stream_index].size();
+  }
+};
+}  // namespace ArcVP
+
+#endif  // KEYFRAME_INDEX_H
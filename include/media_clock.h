@@ -0,0 +1,71 @@
+//
+// Created by delta on 5/21/2025.
+//
+
+#ifndef MEDIA_CLOCK_H
+#define MEDIA_CLOCK_H
+
+#include <cstdint>
+#include <mutex>
+
+namespace ArcVP {
+
+// The playback position everything is synchronized to, in integer
+// microseconds of media time.
+//
+// With the audio master the device callback reports which sample is audible
+// right now (samples handed to SDL, minus what still waits in the stream and
+// in the device buffer) and the clock runs on from that report with the
+// steady clock for at most one device period, so it neither jumps in
+// callback-sized steps nor runs away when the device stalls. The steady
+// master is the fallback for files without audio, the null audio sink, and
+// the rest of a file whose audio ended early.
+class MediaClock {
+ public:
+  enum class Master { Audio, Steady };
+
+ private:
+  mutable std::mutex mtx_;
+  Master master_ = Master::Steady;
+  bool paused_ = true;
+  double speed_ = 1;
+  // media time at steady time anchor_us_
+  int64_t base_us_ = 0;
+  int64_t anchor_us_ = 0;
+  // the audio master has reported since the last set()
+  bool reported_ = false;
+  int64_t max_extrapolate_us_ = 0;
+
+  int64_t timeLocked(int64_t now_us) const;
+
+ public:
+  // `max_extrapolate_us` bounds how far the audio master runs on between
+  // two reports, about one device period
+  void reset(Master master, int64_t max_extrapolate_us = 0);
+
+  Master master() const {
+    std::scoped_lock lk{mtx_};
+    return master_;
+  }
+
+  // jumps to `media_us`, after a seek
+  void set(int64_t media_us);
+
+  void pause();
+  void resume();
+  void setSpeed(double speed);
+
+  // from the device callback: the sample at `media_us` is being played now
+  void reportAudio(int64_t media_us);
+
+  // keeps going from the current position on the steady clock
+  void useSteady();
+
+  // back to the audio master, which takes over with the next report
+  void useAudio();
+
+  int64_t timeUs() const;
+};
+}  // namespace ArcVP
+
+#endif  // MEDIA_CLOCK_H
@@ -12,8 +12,23 @@ extern "C" {
 #include <libswresample/swresample.h>
 #include <libswscale/swscale.h>
 }
+
+#include <mutex>
+#include <string>
+#include <vector>
+
 namespace ArcVP {
 
+// An audio stream of the file, one entry per language or commentary track.
+struct AudioTrack {
+  int stream_index = -1;
+  // from the stream metadata, empty if the file does not say
+  std::string language;
+  std::string title;
+  std::string codec;
+  int channels = 0;
+  int sample_rate = 0;
+};
 
 struct MediaContext {
   AVFormatContext* format_context_ = nullptr;
@@ -25,6 +40,8 @@ struct MediaContext {
   const AVCodecParameters* audio_codec_params_ = nullptr;
   const AVStream *video_stream_ = nullptr, *audio_stream_ = nullptr;
   int video_stream_index_ = -1, audio_stream_index_ = -1;
+  // every audio stream, set on open
+  std::vector<AudioTrack> audio_tracks_;
   std::mutex format_mtx_, video_codec_mtx_, audio_codec_mtx_;
 };
 }  // namespace ArcVP
@@ -0,0 +1,147 @@
+//
+// Created by delta on 5/10/2025.
+//
+
+#ifndef PACKET_QUEUE_H
+#define PACKET_QUEUE_H
+extern "C" {
+#include <libavcodec/packet.h>
+#include <libavutil/mathematics.h>
+}
+
+#include <atomic>
+#include <cstdint>
+
+#include "av_pool.h"
+#include "spsc_ring.h"
+
+namespace ArcVP {
+
+// How far the demuxer may read ahead of the decoders.
+struct ReadAheadLimits {
+  // a stream has "enough" once it holds either this many bytes...
+  int64_t max_bytes = 8 * 1024 * 1024;
+  // ...or this much media time
+  int64_t max_duration_ms = 2000;
+  // hard cap over all streams, so a starving stream can not grow the others
+  int64_t max_total_bytes = 48 * 1024 * 1024;
+};
+
+// Demuxer -> decoder packet queue that keeps track of how many bytes and how
+// much media time it holds. Packets carry the serial of the seek they were
+// read after, packets from before the latest invalidate() are dropped.
+//
+// The demux thread is the only producer, the decoder the only consumer.
+class PacketQueue {
+  struct Entry {
+    AVPacket* pkt = nullptr;  // nullptr marks the end of the file
+    int serial = 0;
+  };
+  SpscRing<Entry> ring_;
+  PacketPool* pool_ = nullptr;
+  AVRational time_base_{1, 1000};
+  std::atomic<int64_t> bytes_ = 0;
+  std::atomic<int64_t> duration_ = 0;
+  std::atomic_int serial_ = 0;
+
+  void release(Entry& entry) {
+    if (entry.pkt) {
+      bytes_ -= entry.pkt->size;
+      duration_ -= entry.pkt->duration;
+      if (pool_) {
+        pool_->release(entry.pkt);
+      } else {
+        av_packet_free(&entry.pkt);
+      }
+    }
+  }
+
+ public:
+  explicit PacketQueue(size_t capacity = 4096) : ring_(capacity) {}
+
+  void setTimeBase(AVRational time_base) { time_base_ = time_base; }
+
+  // where dropped packets go, must outlive the queue
+  void setPool(PacketPool* pool) { pool_ = pool; }
+
+  // producer side
+
+  // returns false if the packet is stale, the caller still owns it then
+  bool push(AVPacket* pkt, int serial) {
+    if (serial != serial_) {
+      return false;
+    }
+    bytes_ += pkt->size;
+    duration_ += pkt->duration;
+    if (!ring_.push({pkt, serial})) {
+      bytes_ -= pkt->size;
+      duration_ -= pkt->duration;
+      return false;
+    }
+    return true;
+  }
+
+  void pushEof(int serial) {
+    if (serial == serial_) {
+      ring_.push({nullptr, serial});
+    }
+  }
+
+  // consumer side
+
+  // blocks until a packet is available, `pkt` is set to nullptr at the end of
+  // the file. `serial` is the seek it was read after. Returns false if the
+  // queue got aborted.
+  bool pop(AVPacket*& pkt, int& serial) {
+    Entry entry;
+    while (ring_.pop(entry)) {
+      if (entry.serial != serial_) {
+        release(entry);
+        continue;
+      }
+      if (entry.pkt) {
+        bytes_ -= entry.pkt->size;
+        duration_ -= entry.pkt->duration;
+      }
+      pkt = entry.pkt;
+      serial = entry.serial;
+      return true;
+    }
+    return false;
+  }
+
+  // any thread: from now on only packets of `serial` are accepted, the ones
+  // queued before are dropped by the consumer as it gets to them
+  void invalidate(int serial) { serial_ = serial; }
+
+  void abort() { ring_.close(); }
+
+  // drops what is still queued and opens the queue again after abort(), only
+  // once neither side uses it
+  void reset() {
+    ring_.flush([this](Entry& entry) { release(entry); });
+    ring_.reset(ring_.capacity());
+    bytes_ = 0;
+    duration_ = 0;
+  }
+
+  int64_t bytes() const { return bytes_; }
+
+  int64_t durationMs() const {
+    return av_rescale_q(duration_, time_base_, {1, 1000});
+  }
+
+  bool empty() const { return ring_.empty(); }
+
+  bool hasEnough(const ReadAheadLimits& limits) const {
+    return bytes_ >= limits.max_bytes ||
+           durationMs() >= limits.max_duration_ms;
+  }
+
+  ~PacketQueue() {
+    ring_.flush([this](Entry& entry) { release(entry); });
+  }
+};
+}  // namespace ArcVP
+
+#endif  // PACKET_QUEUE_H
@@ -0,0 +1,153 @@
+//
+// Created by delta on 5/20/2025.
+//
+
+#ifndef PCM_RING_H
+#define PCM_RING_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include "spsc_ring.h"
+
+namespace ArcVP {
+
+// Interleaved float samples on their way from the audio decode thread to the
+// device callback. The storage is allocated once in reset(). The callback
+// side never blocks or allocates, it takes whatever is there; the decode
+// thread sleeps while the ring is full and is woken by the callback only when
+// it is actually waiting.
+//
+// Writes carry the decoder serial, discard() moves the ring to a new serial so
+// a frame decoded before a seek can not land behind the discarded part.
+class PcmRing {
+  std::vector<float> data_;
+  // positions count samples since the last reset, index = pos % capacity
+  alignas(kCacheLineSize) std::atomic<int64_t> write_pos_{0};
+  alignas(kCacheLineSize) std::atomic<int64_t> read_pos_{0};
+  // everything before this was discarded, the consumer skips it on its own
+  // next read
+  std::atomic<int64_t> discard_pos_{0};
+
+  alignas(kCacheLineSize) std::atomic_bool writer_waiting_{false};
+  std::atomic_bool closed_{false};
+  int serial_ = 0;  // guarded by mtx_
+  std::mutex mtx_;
+  std::condition_variable not_full_;
+
+  // where the consumer continues
+  int64_t readPos() const {
+    return std::max(read_pos_.load(std::memory_order_acquire),
+                    discard_pos_.load(std::memory_order_acquire));
+  }
+
+  // discarded samples take up space until the consumer has moved past them,
+  // it may still be copying them out
+  int64_t space() const {
+    return static_cast<int64_t>(data_.size()) -
+           (write_pos_.load(std::memory_order_relaxed) -
+            read_pos_.load(std::memory_order_acquire));
+  }
+
+ public:
+  // `capacity` in samples (frames * channels), only while no thread uses it
+  void reset(size_t capacity) {
+    data_.assign(capacity, 0.f);
+    write_pos_ = read_pos_ = discard_pos_ = 0;
+    closed_ = false;
+  }
+
+  // producer side
+
+  // blocks until all of `src` is queued. False if the ring got closed or
+  // flushed to another serial, the rest of `src` is dropped then.
+  bool write(const float* src, size_t count, int serial) {
+    std::unique_lock lk{mtx_};
+    while (count > 0) {
+      if (closed_ || serial != serial_) {
+        return false;
+      }
+      int64_t free = space();
+      if (free <= 0) {
+        writer_waiting_.store(true, std::memory_order_seq_cst);
+        not_full_.wait(lk, [&] {
+          return closed_ || serial != serial_ || space() > 0;
+        });
+        writer_waiting_.store(false, std::memory_order_relaxed);
+        continue;
+      }
+      size_t n = std::min<size_t>(count, free);
+      int64_t pos = write_pos_.load(std::memory_order_relaxed);
+      size_t index = pos % data_.size();
+      size_t first = std::min(n, data_.size() - index);
+      std::memcpy(data_.data() + index, src, first * sizeof(float));
+      std::memcpy(data_.data(), src + first, (n - first) * sizeof(float));
+      write_pos_.store(pos + n, std::memory_order_release);
+      src += n;
+      count -= n;
+    }
+    return true;
+  }
+
+  void close() {
+    std::scoped_lock lk{mtx_};
+    closed_ = true;
+    not_full_.notify_all();
+  }
+
+  // consumer side
+
+  // takes up to `count` samples, returns how many there were
+  size_t read(float* dst, size_t count) {
+    int64_t pos = readPos();
+    int64_t available = write_pos_.load(std::memory_order_acquire) - pos;
+    size_t n = std::min<size_t>(count, available);
+    if (n == 0 && pos == read_pos_.load(std::memory_order_relaxed)) {
+      return 0;
+    }
+    // also when only skipping discarded samples, that frees their space
+    size_t index = pos % data_.size();
+    size_t first = std::min(n, data_.size() - index);
+    std::memcpy(dst, data_.data() + index, first * sizeof(float));
+    std::memcpy(dst + first, data_.data(), (n - first) * sizeof(float));
+    read_pos_.store(pos + n, std::memory_order_release);
+    // pairs with the seq_cst store of writer_waiting_: either the writer sees
+    // the space or we see it waiting
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (writer_waiting_.load(std::memory_order_relaxed)) {
+      std::scoped_lock lk{mtx_};
+      not_full_.notify_one();
+    }
+    return n;
+  }
+
+  // any thread: drops everything queued and accepts writes of `serial` only.
+  // The consumer may be reading meanwhile, it skips the dropped samples on
+  // its next read.
+  void discard(int serial) {
+    std::scoped_lock lk{mtx_};
+    serial_ = serial;
+    discard_pos_.store(write_pos_.load(std::memory_order_relaxed),
+                       std::memory_order_release);
+    not_full_.notify_all();
+  }
+
+  bool closed() const { return closed_; }
+
+  size_t size() const {
+    // read position first, so a concurrent read can not make this negative
+    int64_t read = readPos();
+    int64_t write = write_pos_.load(std::memory_order_acquire);
+    return write > read ? write - read : 0;
+  }
+
+  size_t capacity() const { return data_.size(); }
+};
+}  // namespace ArcVP
+
+#endif  // PCM_RING_H
@@ -0,0 +1,194 @@
+//
+// Created by delta on 5/16/2025.
+//
+
+#ifndef PIPELINE_STATS_H
+#define PIPELINE_STATS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace ArcVP {
+using namespace std::chrono;
+
+// Counts events from one thread and turns them into a rate for another.
+// rate() is meant to be polled by a single reader, e.g. the UI once a frame.
+class RateMeter {
+  std::atomic<int64_t> count_ = 0;
+  steady_clock::time_point start_ = steady_clock::now();
+  steady_clock::time_point window_start_ = start_;
+  int64_t window_count_ = 0;
+  double rate_ = 0;
+
+ public:
+  void tick() { count_.fetch_add(1, std::memory_order_relaxed); }
+
+  int64_t count() const { return count_.load(std::memory_order_relaxed); }
+
+  void reset() {
+    count_ = 0;
+    start_ = window_start_ = steady_clock::now();
+    window_count_ = 0;
+    rate_ = 0;
+  }
+
+  // events per second over the last `window`
+  double rate(milliseconds window = 1s) {
+    auto now = steady_clock::now();
+    if (now - window_start_ >= window) {
+      int64_t count = this->count();
+      rate_ = (count - window_count_) /
+              duration<double>(now - window_start_).count();
+      window_start_ = now;
+      window_count_ = count;
+    }
+    return rate_;
+  }
+
+  // events per second since the last reset
+  double averageRate() const {
+    double seconds = duration<double>(steady_clock::now() - start_).count();
+    return seconds > 0 ? count() / seconds : 0;
+  }
+};
+
+inline int64_t elapsedUs(steady_clock::time_point start) {
+  return duration_cast<microseconds>(steady_clock::now() - start).count();
+}
+
+// Latency samples of one pipeline stage, in microseconds. Keeps a uniform
+// reservoir of at most `max_samples` so long runs stay bounded.
+class LatencyRecorder {
+  std::vector<int64_t> samples_;
+  std::mutex mtx_;
+  size_t max_samples_ = 1 << 16;
+  int64_t count_ = 0;
+  int64_t total_ = 0;
+  int64_t max_ = 0;
+  uint64_t rng_ = 0x9e3779b97f4a7c15ull;
+
+ public:
+  struct Summary {
+    int64_t count = 0;
+    double mean = 0;
+    int64_t p50 = 0, p90 = 0, p99 = 0, max = 0;
+  };
+
+  LatencyRecorder() = default;
+  explicit LatencyRecorder(size_t max_samples) : max_samples_(max_samples) {}
+
+  void record(int64_t us) {
+    std::scoped_lock lk{mtx_};
+    count_++;
+    total_ += us;
+    max_ = std::max(max_, us);
+    if (samples_.size() < max_samples_) {
+      samples_.push_back(us);
+      return;
+    }
+    // xorshift, replaces a random sample with probability max/count
+    rng_ ^= rng_ << 13;
+    rng_ ^= rng_ >> 7;
+    rng_ ^= rng_ << 17;
+    uint64_t slot = rng_ % count_;
+    if (slot < max_samples_) {
+      samples_[slot] = us;
+    }
+  }
+
+  // cheap enough to poll every UI frame, unlike summary()
+  double mean() {
+    std::scoped_lock lk{mtx_};
+    return count_ ? double(total_) / count_ : 0;
+  }
+
+  Summary summary() {
+    std::vector<int64_t> sorted;
+    Summary summary;
+    {
+      std::scoped_lock lk{mtx_};
+      sorted = samples_;
+      summary.count = count_;
+      summary.mean = count_ ? double(total_) / count_ : 0;
+      summary.max = max_;
+    }
+    if (sorted.empty()) {
+      return summary;
+    }
+    std::sort(sorted.begin(), sorted.end());
+    auto at = [&](double p) {
+      return sorted[std::min(sorted.size() - 1, size_t(p * sorted.size()))];
+    };
+    summary.p50 = at(.5);
+    summary.p90 = at(.9);
+    summary.p99 = at(.99);
+    return summary;
+  }
+
+  void reset() {
+    std::scoped_lock lk{mtx_};
+    samples_.clear();
+    count_ = total_ = max_ = 0;
+  }
+};
+
+// Per-stage timings of the demux -> decode -> resample -> present pipeline.
+struct PipelineStats {
+  LatencyRecorder demux;         // av_read_frame
+  LatencyRecorder video_decode;  // codec time per video frame
+  LatencyRecorder audio_decode;  // codec time per audio frame
+  LatencyRecorder resample;      // resampleAudioFrame
+  LatencyRecorder convert;       // pixel format conversion per picture
+  LatencyRecorder queue_wait;    // decoded video frame until it is taken
+  // copy of a picture into its texture, on the upload thread or, for the
+  // frames the texture ring could not take, on the render thread
+  LatencyRecorder upload;
+  // drawing and SDL_RenderPresent, with vsync this includes the wait for it
+  LatencyRecorder present;
+  // presented minus intended time on the playback clock, can be negative
+  LatencyRecorder present_error;
+  // pts of the frame on screen minus the audio being heard, audio master only
+  LatencyRecorder av_offset;
+  // seekTo until the first frame at the target is queued
+  LatencyRecorder seek_first_frame;
+  // seek requests replaced by a newer one before they ran
+  std::atomic<int64_t> coalesced_seeks = 0;
+  std::atomic<int64_t> dropped_frames = 0;
+  // frames uploaded on the render thread because no texture was free
+  std::atomic<int64_t> sync_uploads = 0;
+  // decoded after a seek and dropped because they are before its target
+  std::atomic<int64_t> preroll_frames = 0;
+  // device callbacks that found less audio than the device asked for
+  std::atomic<int64_t> audio_underruns = 0;
+  // UI frames drawn and loop iterations that had nothing new to draw
+  std::atomic<int64_t> redraws = 0;
+  std::atomic<int64_t> skipped_redraws = 0;
+
+  void reset() {
+    demux.reset();
+    video_decode.reset();
+    audio_decode.reset();
+    resample.reset();
+    convert.reset();
+    queue_wait.reset();
+    upload.reset();
+    present.reset();
+    present_error.reset();
+    av_offset.reset();
+    seek_first_frame.reset();
+    coalesced_seeks = 0;
+    dropped_frames = 0;
+    sync_uploads = 0;
+    preroll_frames = 0;
+    audio_underruns = 0;
+    redraws = 0;
+    skipped_redraws = 0;
+  }
+};
+}  // namespace ArcVP
+
+#endif  // PIPELINE_STATS_H
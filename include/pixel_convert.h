@@ -0,0 +1,66 @@
+//
+// Created by delta on 5/24/2025.
+//
+
+#ifndef PIXEL_CONVERT_H
+#define PIXEL_CONVERT_H
+extern "C" {
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+#include <libswscale/swscale.h>
+}
+
+namespace ArcVP {
+
+// Converts decoded pictures to what the video textures take: NV12 for the
+// semi-planar formats and 8-bit 4:2:0 planar for everything else. Runs on the
+// video decode thread, so the render loop only ever copies.
+//
+// The common sources have SIMD paths of their own, P010 -> NV12, 10-bit
+// 4:2:0 -> 8-bit and 4:2:2 -> 4:2:0. The rest goes through swscale, with the
+// SwsContext kept for as long as the input format and size stay the same.
+// Output pictures come from a buffer pool sized for the current picture.
+class PixelConverter {
+  AVPixelFormat output_ = AV_PIX_FMT_YUV420P;
+  bool fast_paths_ = true;
+  SwsContext* sws_ = nullptr;
+  AVBufferPool* pool_ = nullptr;
+  size_t pool_size_ = 0;
+
+  bool allocate(AVFrame* out, AVPixelFormat format, int width, int height);
+  bool convertFast(const AVFrame* in, AVFrame* out);
+
+ public:
+  PixelConverter() = default;
+  PixelConverter(const PixelConverter&) = delete;
+  PixelConverter& operator=(const PixelConverter&) = delete;
+  ~PixelConverter();
+
+  // what pictures decoded in `format` are shown as
+  static AVPixelFormat outputFormat(AVPixelFormat format);
+
+  // the SIMD kernels picked for this CPU: "avx2", "sse2" or "scalar"
+  static const char* kernelName();
+
+  // only valid before the video decode thread starts
+  void setOutput(AVPixelFormat format) { output_ = format; }
+
+  AVPixelFormat output() const { return output_; }
+
+  // swscale for every input, to compare against the fast paths
+  void setFastPaths(bool enabled) { fast_paths_ = enabled; }
+
+  // whether a picture in `format` needs converting at all
+  bool needed(AVPixelFormat format) const;
+
+  // how a picture in `format` gets converted: a fast path, "swscale", or
+  // "none"
+  const char* pathName(AVPixelFormat format) const;
+
+  // converts `in` into `out`, a frame without buffers. Frame properties such
+  // as the timestamps are copied over.
+  bool convert(const AVFrame* in, AVFrame* out);
+};
+}  // namespace ArcVP
+
+#endif  // PIXEL_CONVERT_H
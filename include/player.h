@@ -12,15 +12,29 @@
 #include <mutex>
 #include <optional>
 #include <queue>
+#include <string>
 #include <thread>
 #include <vector>
 
 #include "audio_device.h"
+#include "audio_resampler.h"
+#include "av_pool.h"
 #include "channel.h"
 #include "decode_worker.h"
+#include "degradation.h"
+#include "demux_worker.h"
+#include "frame_arena.h"
 #include "frame_queue.h"
+#include "keyframe_index.h"
+#include "media_clock.h"
 #include "media_context.h"
+#include "pcm_ring.h"
+#include "pipeline_stats.h"
+#include "pixel_convert.h"
+#include "seek_slot.h"
 #include "sync_state.h"
+#include "time_stretch.h"
+#include "timebase.h"
 #include "imgui.h"
 #include "backends/imgui_impl_sdl3.h"
 #include "backends/imgui_impl_sdlrenderer3.h"
@@ -29,20 +43,85 @@ extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libavutil/avutil.h>
+#include <libavutil/pixdesc.h>
 #include <libswresample/swresample.h>
 #include <libswscale/swscale.h>
 }
 
 namespace ArcVP {
 
-int64_t ptsToTime(int64_t pts, AVRational timebase);
+const char* threadTypeName(int threadType);
 
-int64_t timeToPts(int64_t milli, AVRational timebase);
+// get callback of the audio stream, feeds the device from the PcmRing
+void audioCallback(void* userdata, SDL_AudioStream* stream,
+                   int additional_amount, int total_amount);
 enum ArcVPEvent {
   ARCVP_EVENT_NEXTFRAME = SDL_EVENT_USER + 1,
   ARCVP_EVENT_FINISH,
 };
 
+// frames presented later than this are dropped
+constexpr int64_t kMaxLateMs = 100;
+
+// keyframes shown per second of wall time in keyframes-only fast-forward
+constexpr int kFastForwardFps = 8;
+
+// Where decoded output ends up. The null sinks replace the audio device and
+// the renderer for headless runs such as arcvp_bench.
+struct SinkConfig {
+  // discard PCM instead of queueing it on an SDL audio stream
+  bool null_audio = false;
+  // the null audio sink consumes samples at playback rate, otherwise as fast
+  // as they are decoded
+  bool realtime = true;
+};
+
+// How far open() reads into the file to identify the streams. A file that
+// can not be identified within this is probed again with `retry_factor` times
+// the budget. FFmpeg's own defaults are 5MB and 5s.
+//
+// A file with a fresh keyframe index cache was opened before, and is probed
+// with the much smaller `cached_*` budget first. That is enough for the
+// parameters of the usual streams, anything short of that falls back to the
+// full budget.
+struct ProbeConfig {
+  int64_t probesize = 1 << 20;
+  int64_t analyzeduration_us = 1'000'000;
+  int retry_factor = 8;
+  int64_t cached_probesize = 64 << 10;
+  // zero would mean FFmpeg's default
+  int64_t cached_analyzeduration_us = 100'000;
+};
+
+// Progress of openAsync, in order. Failed sorts last.
+enum class OpenState {
+  Idle,
+  Probing,
+  // streams and codecs are set up, startPlayback may be called
+  CodecsReady,
+  // the first frame of the presented stream is decoded
+  FirstFrameReady,
+  Failed,
+};
+
+const char* openStateName(OpenState state);
+
+// microseconds since openAsync
+struct OpenTimings {
+  std::atomic<int64_t> codecs_ready_us = 0;
+  std::atomic<int64_t> first_frame_us = 0;
+  std::atomic_int probe_attempts = 0;
+  // the first probe used the budget for cached files
+  std::atomic_bool cached_probe = false;
+
+  void reset() {
+    codecs_ready_us = 0;
+    first_frame_us = 0;
+    probe_attempts = 0;
+    cached_probe = false;
+  }
+};
+
 struct NextFrameEvent {
   AVFrame* frame;
   int64_t present_ms;
@@ -51,28 +130,145 @@ struct NextFrameEvent {
 class Player {
   MediaContext media_{};
 
+  // declared before the workers, queued objects are released into them
+  FramePool frame_pool_{};
+  PacketPool packet_pool_{1024};
+  // picture buffers of the video decoder, kept across seeks and reopens
+  FrameArena* frame_arena_ = nullptr;
+  // decoded pictures to a texture format, video decode thread only
+  PixelConverter pixel_converter_{};
+
 
   DecodeWorker audio_decode_worker_, video_decode_worker_;
+  DemuxWorker demux_worker_;
+
+  KeyframeIndex keyframe_index_{};
+  std::unique_ptr<std::thread> index_thread_ = nullptr;
+  // close() gives up on an index pass still running
+  std::atomic_bool index_cancel_ = false;
+
+  ProbeConfig probe_config_{};
+  std::atomic<OpenState> open_state_ = OpenState::Idle;
+  std::mutex open_mtx_;
+  std::condition_variable open_cv_;
+  std::unique_ptr<std::thread> open_thread_ = nullptr;
+  int64_t open_started_us_ = 0;
+  OpenTimings open_timings_{};
+  // startPlayback ran before the first frame, the clock starts with it
+  std::atomic_bool play_on_first_frame_ = false;
 
   AudioDevice audio_device_{};
 
+  AudioOutputConfig audio_output_config_{};
+  // what the ring and the audio stream carry: float at the rate and layout
+  // of the track opened first, tracks selected later are resampled to it
+  int audio_rate_ = 0;
+  AVChannelLayout audio_layout_{};
+  // the track selectAudioTrack asked for last
+  std::atomic_int audio_track_ = -1;
+  // An audio track switch on its way. selectAudioTrack opens the codec, the
+  // demuxer switches streams with the seek of `serial` and the audio decoder
+  // takes the codec over once it gets to that serial.
+  struct TrackSwitch {
+    int stream_index = -1;
+    const AVCodec* codec = nullptr;
+    AVCodecContext* codec_context = nullptr;
+    int serial = 0;
+  };
+  std::mutex track_switch_mtx_;
+  TrackSwitch requested_track_{}, switched_track_{};
+  AudioResampler resampler_{};
   std::vector<uint8_t> audio_buffer_{};
+  // between the resampler and the ring, audio decode thread only
+  TimeStretch stretch_{};
+  std::vector<float> stretch_out_{};
+  int stretch_serial_ = 0;
+  // speed of the time-stretch, 1 while the audio stream resamples instead.
+  // Every sample in the ring stands for this many media samples.
+  std::atomic<float> stretch_speed_ = 1;
+  // media samples the callback owes sample_count_ below one
+  double callback_media_carry_ = 0;
+  // nowUs() after which the device has played the end of an audio-only file,
+  // 0 until SDL's stream ran dry. Audio callback only.
+  int64_t drain_until_us_ = 0;
+  // decoded audio waiting for the device callback
+  PcmRing pcm_ring_{};
+  // where the callback copies samples out of the ring, sized with it
+  std::vector<float> callback_pcm_{};
   SDL_AudioStream* audio_stream=nullptr;
 
   int width = -1, height = -1;
 
   float speed = 1.;
 
-  void packetDecodeThreadWorker();
+  QueueBudget queue_budget_{};
+  DecodeThreadConfig decode_thread_config_{};
+  SinkConfig sink_config_{};
+  SeekMode seek_mode_ = SeekMode::Exact;
+  SeekSlot seek_slot_{};
+  // last serial handed out by seekTo
+  std::atomic_int seek_serial_ = 0;
+  // the first frame at a seek target is shown even while paused, so seeking
+  // and stepping while paused do not leave the old picture up
+  std::atomic_bool pending_seek_frame_ = false;
+  MediaClock clock_{};
+  DegradationController degradation_{};
+  // decoding skipped because of the playback speed, audio is muted while this
+  // is not None
+  std::atomic_int fast_forward_level_ = 0;
+  // media time between two keyframes in keyframes-only fast-forward
+  std::atomic<int64_t> fast_forward_step_ms_ = 0;
+  // what the video codec context is set to, video decode thread only
+  DegradationLevel applied_degradation_ = DegradationLevel::None;
+
+  PipelineStats stats_{};
+  bool render_on_demand_ = true;
+  // streaming textures the video is shown from, 2 or 3
+  int texture_ring_depth_ = 3;
+  // present_ms of the frame getVideoFrame handed out last, until it is shown
+  int64_t presenting_ms_ = AV_NOPTS_VALUE;
+
+  void demuxThreadWorker();
+
+  void skipToDueKeyframe(int64_t pts, int serial);
+
+  static int interruptCallback(void* opaque);
+  AVFormatContext* probeInput(const std::string& filename);
+  AVCodecContext* openVideoCodec(const AVCodec* codec,
+                                 const AVCodecParameters* params);
+  AVCodecContext* openAudioCodec(const AVCodec* codec,
+                                 const AVCodecParameters* params);
+  bool openMedia(const std::string& filename);
+  // waits for the open thread of the last openAsync, if any
+  void joinOpenThread();
+  void stopIndexThread();
+  void stopWorkers();
+  void setOpenState(OpenState state);
+  void firstFrameReady();
+
+  void performSeek(const SeekRequest& request);
+  void switchAudioStream(int serial);
+  void takeAudioTrackSwitch(int serial);
+
+  void restartDecoder(DecodeWorker& worker, AVCodecContext* codec_context,
+                      int serial);
+
+  void indexThreadWorker(std::string filename);
 
   void videoDecodeThreadWorker();
 
   void audioDecodeThreadWorker();
 
   bool setupAudioDevice();
-  Player() {};
+  void fillAudioStream(SDL_AudioStream* stream, int bytes);
+  bool audioDrained(SDL_AudioStream* stream);
+  void waitNullAudioSink();
+  Player() {
+    video_decode_worker_.packet_chan.setPool(&packet_pool_);
+    audio_decode_worker_.packet_chan.setPool(&packet_pool_);
+  };
   inline static Player* instance_ptr = nullptr;
-  void demuxAllPackets();
+  bool readAheadFull();
 
   AVFrame* decodeVideoFrame();
   AVFrame* decodeAudioFrame();
@@ -81,41 +277,162 @@ class Player {
 
   void setPlaybackSpeed(float);
 
+  // takes effect on the next open
+  void setQueueBudget(const QueueBudget& budget) { queue_budget_ = budget; }
+
+  // takes effect on the next open
+  void setDecodeThreadConfig(const DecodeThreadConfig& config) {
+    decode_thread_config_ = config;
+  }
+
+  // takes effect on the next startPlayback
+  void setAudioOutputConfig(const AudioOutputConfig& config) {
+    audio_output_config_ = config;
+  }
+
+  // takes effect on the next startPlayback
+  void setSinkConfig(const SinkConfig& config) { sink_config_ = config; }
+
+  // what seekTo(milli) does
+  void setSeekMode(SeekMode mode) { seek_mode_ = mode; }
+
+  SeekMode seekMode() const { return seek_mode_; }
+
+  PipelineStats& stats() { return stats_; }
+
+  // redraw only when something changed, toggled from the control panel
+  bool renderOnDemand() const { return render_on_demand_; }
+
+  // double or triple buffered video textures, toggled from the control panel
+  int textureRingDepth() const { return texture_ring_depth_; }
+
+  const AVCodecContext* videoCodecContext() const {
+    return media_.video_codec_context_;
+  }
+
+  // what the frames from getVideoFrame are in, set on open
+  AVPixelFormat videoOutputFormat() const { return pixel_converter_.output(); }
+
+  // every audio stream of the file, valid once the codecs are ready
+  const std::vector<AudioTrack>& audioTracks() const {
+    return media_.audio_tracks_;
+  }
+
+  // stream index of the audio track playing, or about to
+  int audioTrack() const { return audio_track_; }
+
+  // switches to another audio track of the file without reopening it. The
+  // playback position is kept, the new track is heard once the seek to it
+  // is through.
+  bool selectAudioTrack(int stream_index);
+
+  bool hasVideo() const { return media_.video_stream_index_ >= 0; }
+  bool hasAudio() const { return media_.audio_stream_index_ >= 0; }
+
+  int64_t durationMs() const {
+    return media_.format_context_ && media_.format_context_->duration > 0
+               ? media_.format_context_->duration / 1000
+               : 0;
+  }
+
   void controlPanel();
   AVFrame* getVideoFrame() {
-    retry:
-    if (video_decode_worker_.output_queue.queue.empty()) {
-      return nullptr;
-    }
-    auto front=video_decode_worker_.output_queue.queue.front();
-    if (front.present_ms==AV_NOPTS_VALUE) {
-      sync_state_.should_exit=true;
-      return nullptr;
-    }
-    int64_t played_ms=getPlayedMs();
-    if (played_ms>=front.present_ms) {
+    auto& queue = video_decode_worker_.output_queue;
+    FrameQueue::RenderEntry entry;
+    while (auto front = queue.front()) {
+      if (front->serial != video_decode_worker_.serial) {
+        // decoded before the last seek
+        queue.tryPop(entry);
+        frame_pool_.release(entry.frame);
+        continue;
+      }
+      if (front->present_ms == AV_NOPTS_VALUE) {
+        sync_state_.should_exit = true;
+        return nullptr;
+      }
+      int64_t played_ms = getPlayedMs();
+      if (sync_state_.pause && pending_seek_frame_.exchange(false)) {
+        // the clock stands still, show the frame at the target once
+        queue.tryPop(entry);
+        return entry.frame;
+      }
+      if (played_ms < front->present_ms) {
+        return nullptr;
+      }
       // display this frame
-      int dt=played_ms-front.present_ms;
-      bool drop=false;
+      int dt = played_ms - front->present_ms;
+      queue.tryPop(entry);
+      // media time passes `speed` times faster than wall time
+      float wall_scale = std::max(1.f, speed);
+      degradation_.observe(dt / wall_scale, queue.fill(), nowUs());
       // too late, drop frame;
-      if (dt>100) {
-        spdlog::debug("DROP played: {}, present: {}",played_ms,front.present_ms);
-        drop=true;
-      }
-      video_decode_worker_.output_queue.semReady.acquire();
-      video_decode_worker_.output_queue.mtx.lock();
-      video_decode_worker_.output_queue.queue.pop_front();
-      video_decode_worker_.output_queue.mtx.unlock();
-      video_decode_worker_.output_queue.semEmpty.release();
-      if (drop) {
-        av_frame_free(&front.frame);
-        goto retry;
+      if (dt > kMaxLateMs * wall_scale) {
+        spdlog::debug("DROP played: {}, present: {}", played_ms,
+                      entry.present_ms);
+        stats_.dropped_frames++;
+        frame_pool_.release(entry.frame);
+        continue;
       }
-      return front.frame;
+      stats_.queue_wait.record(nowUs() - entry.queued_us);
+      presenting_ms_ = entry.present_ms;
+      pending_seek_frame_ = false;
+      return entry.frame;
     }
     return nullptr;
   }
 
+  // when the front frame of the video queue is due, AV_NOPTS_VALUE if there
+  // is nothing to present
+  int64_t nextPresentMs() {
+    auto& queue = video_decode_worker_.output_queue;
+    FrameQueue::RenderEntry entry;
+    while (auto front = queue.front()) {
+      if (front->serial == video_decode_worker_.serial) {
+        return front->present_ms;
+      }
+      // decoded before the last seek, dropped here even while paused so the
+      // decoder does not wait on a full queue of them
+      queue.tryPop(entry);
+      frame_pool_.release(entry.frame);
+    }
+    return AV_NOPTS_VALUE;
+  }
+
+  // whether getVideoFrame has a frame to show while paused
+  bool pendingSeekFrame() const { return pending_seek_frame_; }
+
+  // call once the frame from getVideoFrame is on screen
+  void framePresented() {
+    if (presenting_ms_ == AV_NOPTS_VALUE) {
+      return;
+    }
+    int64_t played_us = getPlayedUs();
+    stats_.present_error.record(played_us - presenting_ms_ * 1000);
+    if (clock_.master() == MediaClock::Master::Audio) {
+      stats_.av_offset.record(presenting_ms_ * 1000 - played_us);
+    }
+    presenting_ms_ = AV_NOPTS_VALUE;
+  }
+
+  // next decoded video frame regardless of the clock, blocks until there is
+  // one. False at the end of the file or on exit, the frame goes back through
+  // releaseFrame.
+  bool takeVideoFrame(FrameQueue::RenderEntry& entry) {
+    auto& queue = video_decode_worker_.output_queue;
+    while (queue.pop(entry)) {
+      if (entry.serial != video_decode_worker_.serial) {
+        frame_pool_.release(entry.frame);
+        continue;
+      }
+      if (entry.present_ms == AV_NOPTS_VALUE) {
+        return false;
+      }
+      stats_.queue_wait.record(nowUs() - entry.queued_us);
+      return true;
+    }
+    return false;
+  }
+
   static Player* instance() {
     if (!instance_ptr) {
       instance_ptr = new Player();
@@ -128,24 +445,49 @@ class Player {
 
   ~Player() {
     sync_state_.should_exit=true;
-    video_decode_worker_.output_queue.mtx.lock();
-    while (!video_decode_worker_.output_queue.queue.empty()) {
-      auto frame=video_decode_worker_.output_queue.queue.front().frame;
-      av_frame_free(&frame);
-      video_decode_worker_.output_queue.queue.pop_front();
-      video_decode_worker_.output_queue.semEmpty.release();
+    // a probe in progress gives up through the interrupt callback
+    if (open_thread_ && open_thread_->joinable()) open_thread_->join();
+    video_decode_worker_.output_queue.close();
+    audio_decode_worker_.output_queue.close();
+    video_decode_worker_.packet_chan.abort();
+    audio_decode_worker_.packet_chan.abort();
+    pcm_ring_.close();
+    demux_worker_.wake();
+
+    demux_worker_.join();
+    if (index_thread_ && index_thread_->joinable()) index_thread_->join();
+    video_decode_worker_.join();
+    audio_decode_worker_.join();
+    video_decode_worker_.output_queue.clear(frame_pool_);
+    audio_decode_worker_.output_queue.clear(frame_pool_);
+    if (frame_arena_) {
+      frame_arena_->retire();
     }
-    video_decode_worker_.output_queue.mtx.unlock();
+  }
 
+  // hands a frame returned by getVideoFrame back to the pool
+  void releaseFrame(AVFrame* frame) { frame_pool_.release(frame); }
 
+  const FramePool& framePool() const { return frame_pool_; }
+  const PacketPool& packetPool() const { return packet_pool_; }
 
-    video_decode_worker_.join();
-    audio_decode_worker_.join();
-  }
 
+  // returns right away, openState() tells how far it got
+  void openAsync(const std::string& filename);
 
+  // openAsync, and waits until the codecs are ready
   bool open(const char*);
 
+  OpenState openState() const { return open_state_; }
+
+  // blocks until the open got to `state` or failed, returns where it is
+  OpenState waitOpenState(OpenState state);
+
+  const OpenTimings& openTimings() const { return open_timings_; }
+
+  // takes effect on the next open
+  void setProbeConfig(const ProbeConfig& config) { probe_config_ = config; }
+
   void close();
 
   void exit() {
@@ -155,7 +497,7 @@ class Player {
   }
 
   void startPlayback();
-  friend void audioCallback(void* userdata, SDL_AudioStream* stream, int ,int);
+  friend void audioCallback(void* userdata, SDL_AudioStream* stream, int, int);
 
   void togglePause() {
     if (sync_state_.pause) {
@@ -167,7 +509,11 @@ class Player {
   void pause();
   void unpause();
 
-  void seekTo(std::int64_t milli);
+  void seekTo(std::int64_t milli) { seekTo(milli, seek_mode_); }
+
+  // returns right away, the demux thread seeks and the decoders follow. What
+  // was queued before is dropped from here on.
+  void seekTo(std::int64_t milli, SeekMode mode);
 
   void speedUp();
 
@@ -178,20 +524,23 @@ class Player {
   std::tuple<int, int> getWH() { return std::make_tuple(width, height); }
   SyncState sync_state_{};
 
-  int64_t getPlayedMs() {
-    return sync_state_.sample_count_ * 1000. /
-           media_.audio_codec_params_->sample_rate;
+  const MediaClock& clock() const { return clock_; }
+
+  DegradationController& degradation() { return degradation_; }
+
+  double videoQueueFill() const {
+    return video_decode_worker_.output_queue.fill();
   }
-};
 
-using namespace std::chrono;
+  DegradationLevel fastForward() const {
+    return static_cast<DegradationLevel>(fast_forward_level_.load());
+  }
 
-inline int64_t ptsToTime(int64_t pts, AVRational timebase) {
-  return pts * 1000. * timebase.num / timebase.den;
-}
+  int64_t getPlayedMs() { return clock_.timeUs() / 1000; }
 
-inline int64_t timeToPts(int64_t milli, AVRational timebase) {
-  return milli / 1000. * timebase.den / timebase.num;
-}
+  int64_t getPlayedUs() { return clock_.timeUs(); }
+};
+
+using namespace std::chrono;
 }  // namespace ArcVP
 #endif  // ARCVP_H
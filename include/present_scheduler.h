@@ -0,0 +1,87 @@
+//
+// Created by delta on 5/19/2025.
+//
+
+#ifndef PRESENT_SCHEDULER_H
+#define PRESENT_SCHEDULER_H
+extern "C" {
+#include <libavutil/avutil.h>
+}
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+namespace ArcVP {
+
+// How long the render loop may block in SDL_WaitEventTimeout: until shortly
+// before the next queued frame is due, so input ends the wait early and a due
+// frame is not held back by a fixed poll interval. The last stretch up to the
+// deadline is spun, SDL_WaitEventTimeout only has millisecond resolution and
+// the OS may oversleep by a scheduler tick. With vsync on, SDL_RenderPresent
+// then lines the frame up with the display.
+struct PresentScheduler {
+  // nothing to present: paused, at the end of the file, or no video at all
+  int idle_ms = 100;
+  // playing but the queue is empty, check back soon for the decoder
+  int starving_ms = 5;
+  // sleep until this close to a deadline, spin for the rest
+  int64_t spin_us = 2000;
+
+  // `next_present_us` is the front frame of the video queue, AV_NOPTS_VALUE
+  // if there is none
+  int timeoutMs(int64_t played_us, int64_t next_present_us,
+                bool paused) const {
+    if (paused) {
+      return idle_ms;
+    }
+    if (next_present_us == AV_NOPTS_VALUE) {
+      return starving_ms;
+    }
+    return std::clamp<int64_t>((next_present_us - played_us - spin_us) / 1000,
+                               0, idle_ms);
+  }
+
+  // yields until `clock()` reaches `deadline_us`, if that is within spin_us.
+  // Gives up after twice that much wall time in case the clock stalls.
+  template <typename Clock>
+  void spinUntil(int64_t deadline_us, Clock&& clock) const {
+    if (deadline_us - clock() > spin_us) {
+      return;
+    }
+    auto give_up = std::chrono::steady_clock::now() +
+                   std::chrono::microseconds(2 * spin_us);
+    while (clock() < deadline_us &&
+           std::chrono::steady_clock::now() < give_up) {
+      std::this_thread::yield();
+    }
+  }
+};
+
+// Render-on-demand: the loop only rebuilds and presents the UI when something
+// on screen changed, a new video frame, input, a resize, or the live numbers
+// of the control panel getting stale.
+struct RedrawTracker {
+  // refresh rate of the control panel's clock and statistics when nothing
+  // else triggers a redraw
+  int64_t panel_refresh_ms = 500;
+  // frames still owed, ImGui needs one more frame after input to settle
+  // hover and active states
+  int pending = 1;
+  int64_t last_draw_us = 0;
+
+  void invalidate(int frames = 2) { pending = std::max(pending, frames); }
+
+  bool shouldDraw(int64_t now_us) {
+    if (pending == 0 && now_us - last_draw_us < panel_refresh_ms * 1000) {
+      return false;
+    }
+    pending = std::max(0, pending - 1);
+    last_draw_us = now_us;
+    return true;
+  }
+};
+}  // namespace ArcVP
+
+#endif  // PRESENT_SCHEDULER_H
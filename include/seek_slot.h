@@ -0,0 +1,61 @@
+//
+// Created by delta on 5/21/2025.
+//
+
+#ifndef SEEK_SLOT_H
+#define SEEK_SLOT_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+
+namespace ArcVP {
+
+// Where a seek lands.
+enum class SeekMode {
+  // on the keyframe at or before the target, shown right away
+  Keyframe,
+  // on the frame shown at the target. The frames from the keyframe up to it
+  // are decoded as cheaply as possible and dropped.
+  Exact,
+};
+
+struct SeekRequest {
+  int64_t target_ms = 0;
+  SeekMode mode = SeekMode::Exact;
+  // seek serial everything read and decoded for this request carries
+  int serial = 0;
+  // nowUs() when the UI asked for it
+  int64_t requested_us = 0;
+};
+
+// Hands seeks from the UI to the demux thread. Holds one request: posting
+// while the previous one is still waiting replaces it, so holding down a
+// seek key costs one seek per demuxer iteration, not one per key repeat.
+class SeekSlot {
+  std::mutex mtx_;
+  std::optional<SeekRequest> request_;
+  std::atomic_bool pending_ = false;
+
+ public:
+  void post(const SeekRequest& request) {
+    std::scoped_lock lk{mtx_};
+    request_ = request;
+    pending_.store(true, std::memory_order_release);
+  }
+
+  std::optional<SeekRequest> take() {
+    std::scoped_lock lk{mtx_};
+    std::optional<SeekRequest> request;
+    request.swap(request_);
+    pending_.store(false, std::memory_order_relaxed);
+    return request;
+  }
+
+  // cheap enough for the demuxer to poll between packets
+  bool pending() const { return pending_.load(std::memory_order_acquire); }
+};
+}  // namespace ArcVP
+
+#endif  // SEEK_SLOT_H
@@ -0,0 +1,185 @@
+//
+// Created by delta on 5/13/2025.
+//
+
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace ArcVP {
+
+inline constexpr size_t kCacheLineSize = 64;
+
+// Fixed-capacity single-producer/single-consumer ring.
+//
+// The fast path is one acquire load and one release store per side, the
+// producer and consumer indices live on their own cache lines and each side
+// keeps a cached copy of the other index so it only touches the shared line
+// when it looks full/empty. The blocking variants spin briefly and then park
+// on a condition variable, the mutex is only taken by a side that actually
+// has to sleep and by the other side when it sees a sleeper.
+template <typename T>
+class SpscRing {
+  static constexpr int kSpinCount = 64;
+
+  std::unique_ptr<T[]> slots_;
+  size_t capacity_ = 0;
+  size_t mask_ = 0;
+
+  alignas(kCacheLineSize) std::atomic<size_t> head_{0};  // consumer
+  size_t cached_tail_ = 0;
+  alignas(kCacheLineSize) std::atomic<size_t> tail_{0};  // producer
+  size_t cached_head_ = 0;
+
+  alignas(kCacheLineSize) std::atomic_bool closed_{false};
+  std::atomic_bool producer_waiting_{false};
+  std::atomic_bool consumer_waiting_{false};
+  std::mutex wait_mtx_;
+  std::condition_variable not_full_, not_empty_;
+
+  static size_t roundUp(size_t n) {
+    size_t p = 1;
+    while (p < n) p <<= 1;
+    return p;
+  }
+
+  void wake(std::atomic_bool& waiting, std::condition_variable& cv) {
+    // pairs with the fence in park(): either the sleeper sees our index
+    // update or we see its flag
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiting.load(std::memory_order_relaxed)) {
+      std::scoped_lock lk{wait_mtx_};
+      cv.notify_one();
+    }
+  }
+
+  template <typename Ready>
+  void park(std::atomic_bool& waiting, std::condition_variable& cv,
+            Ready ready) {
+    for (int i = 0; i < kSpinCount; i++) {
+      if (ready() || closed_.load(std::memory_order_acquire)) return;
+    }
+    std::unique_lock lk{wait_mtx_};
+    waiting.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    cv.wait(lk,
+            [&] { return ready() || closed_.load(std::memory_order_acquire); });
+    waiting.store(false, std::memory_order_relaxed);
+  }
+
+  bool full() {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - cached_head_ < capacity_) return false;
+    cached_head_ = head_.load(std::memory_order_acquire);
+    return tail - cached_head_ >= capacity_;
+  }
+
+  bool hasItem() {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (cached_tail_ != head) return true;
+    cached_tail_ = tail_.load(std::memory_order_acquire);
+    return cached_tail_ != head;
+  }
+
+ public:
+  explicit SpscRing(size_t capacity) { reset(capacity); }
+
+  SpscRing(const SpscRing&) = delete;
+  SpscRing& operator=(const SpscRing&) = delete;
+
+  // resizes the ring, only valid while neither side is using it. Storage is
+  // rounded up to a power of two, but at most `capacity` items are queued.
+  void reset(size_t capacity) {
+    capacity_ = capacity < 1 ? 1 : capacity;
+    mask_ = roundUp(capacity_) - 1;
+    slots_ = std::make_unique<T[]>(mask_ + 1);
+    head_ = tail_ = 0;
+    cached_head_ = cached_tail_ = 0;
+    closed_ = false;
+  }
+
+  // producer side
+
+  bool tryPush(T value) {
+    if (closed_.load(std::memory_order_acquire) || full()) return false;
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    slots_[tail & mask_] = std::move(value);
+    tail_.store(tail + 1, std::memory_order_release);
+    wake(consumer_waiting_, not_empty_);
+    return true;
+  }
+
+  // blocks while the ring is full, returns false if it got closed
+  bool push(T value) {
+    while (!closed_.load(std::memory_order_acquire)) {
+      if (!full()) return tryPush(std::move(value));
+      park(producer_waiting_, not_full_, [this] { return !full(); });
+    }
+    return false;
+  }
+
+  // consumer side
+
+  bool tryPop(T& out) {
+    if (!hasItem()) return false;
+    size_t head = head_.load(std::memory_order_relaxed);
+    out = std::move(slots_[head & mask_]);
+    head_.store(head + 1, std::memory_order_release);
+    wake(producer_waiting_, not_full_);
+    return true;
+  }
+
+  // blocks while the ring is empty, returns false once it is closed
+  bool pop(T& out) {
+    while (!closed_.load(std::memory_order_acquire)) {
+      if (tryPop(out)) return true;
+      park(consumer_waiting_, not_empty_, [this] { return hasItem(); });
+    }
+    return false;
+  }
+
+  // oldest item, stays valid until the consumer pops it
+  T* front() {
+    if (!hasItem()) return nullptr;
+    return &slots_[head_.load(std::memory_order_relaxed) & mask_];
+  }
+
+  // drops every queued item for a seek, `release` gets each one
+  template <typename Fn>
+  void flush(Fn&& release) {
+    T item;
+    while (tryPop(item)) {
+      release(item);
+    }
+  }
+
+  // wakes both sides, blocking calls return false from now on
+  void close() {
+    closed_.store(true, std::memory_order_release);
+    std::scoped_lock lk{wait_mtx_};
+    not_full_.notify_all();
+    not_empty_.notify_all();
+  }
+
+  bool closed() const { return closed_.load(std::memory_order_acquire); }
+
+  // approximate when called concurrently
+  size_t size() const {
+    // head first, tail can only have moved further by the time we read it
+    size_t head = head_.load(std::memory_order_acquire);
+    return tail_.load(std::memory_order_acquire) - head;
+  }
+
+  bool empty() const { return size() == 0; }
+
+  size_t capacity() const { return capacity_; }
+};
+}  // namespace ArcVP
+
+#endif  // SPSC_RING_H
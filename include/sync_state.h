@@ -4,6 +4,7 @@
 
 #ifndef SYNC_STATE_H
 #define SYNC_STATE_H
+#include <atomic>
 #include <chrono>
 #include <cstdint>
 #include <mutex>
@@ -13,7 +14,9 @@ using namespace std::chrono;
 using namespace std::chrono_literals;
 struct SyncState {
   steady_clock::time_point audio_start_{};
-  int64_t sample_count_=0;
+  // audio samples per channel handed to the output since the last seek,
+  // counted from the seek target
+  std::atomic<int64_t> sample_count_=0;
   std::atomic_bool should_exit=false;
   std::atomic_bool pause=true;
   std::mutex mtx_{};
@@ -0,0 +1,123 @@
+//
+// Created by delta on 5/23/2025.
+//
+
+#ifndef TEXTURE_RING_H
+#define TEXTURE_RING_H
+extern "C" {
+#include <SDL3/SDL.h>
+#include <libavutil/frame.h>
+}
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "pipeline_stats.h"
+
+namespace ArcVP {
+
+// Streaming YV12 or NV12 textures the render loop shows from, with the copy
+// of a decoded picture into its texture done on an upload thread instead of
+// in SDL_UpdateYUVTexture on the render thread.
+//
+// SDL textures may only be locked and unlocked on the render thread, so a
+// texture goes around the ring as
+//   Free -> (render thread locks it) Copying -> (upload thread fills it)
+//   Ready -> (render thread unlocks it) Shown -> Free
+// and only the memcpy into the locked pixels runs elsewhere. Unlocking is
+// what hands the pixels to the GPU on accelerated renderers.
+class TextureRing {
+ public:
+  // takes back a frame once it is copied
+  using ReleaseFrame = std::function<void(AVFrame*)>;
+
+ private:
+  enum class State { Free, Copying, Ready, Shown };
+  struct Slot {
+    SDL_Texture* texture = nullptr;
+    State state = State::Free;
+    // set while Copying
+    AVFrame* frame = nullptr;
+    uint8_t* pixels = nullptr;
+    int pitch = 0;
+    // submit order, the newest Ready slot is shown
+    int64_t sequence = 0;
+  };
+
+  std::vector<Slot> slots_;
+  int width_ = 0, height_ = 0;
+  AVPixelFormat format_ = AV_PIX_FMT_YUV420P;
+  ReleaseFrame release_;
+  // pushed when a copy finishes, wakes the render loop
+  Uint32 wake_event_ = 0;
+  LatencyRecorder* upload_times_ = nullptr;
+  int64_t next_sequence_ = 0;
+  // a synchronous upload made another texture current
+  bool changed_ = false;
+  int shown_ = -1;
+
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  bool exit_ = false;
+  std::thread uploader_;
+
+  void uploadThreadWorker();
+  void copy(Slot& slot) const;
+  // render thread, waits until the upload thread is idle
+  void waitCopies(std::unique_lock<std::mutex>& lk);
+
+ public:
+  TextureRing() = default;
+  TextureRing(const TextureRing&) = delete;
+  TextureRing& operator=(const TextureRing&) = delete;
+  ~TextureRing() { destroy(); }
+
+  // the texture format pictures in `format` are shown from, yuv420p and
+  // nv12 only, the rest is converted first
+  static SDL_PixelFormat textureFormat(AVPixelFormat format);
+
+  // `depth` textures of `width` x `height` for pictures in `format`, at
+  // least two: one on screen and one being filled. With three the next
+  // picture can be copied while the one before it still waits to be shown.
+  // Every upload is timed into `upload_times` if given.
+  bool create(SDL_Renderer* renderer, int width, int height,
+              AVPixelFormat format, int depth, ReleaseFrame release,
+              Uint32 wake_event, LatencyRecorder* upload_times = nullptr);
+
+  // releases the frames still waiting to be copied
+  void destroy();
+
+  bool created() const { return !slots_.empty(); }
+
+  int depth() const { return static_cast<int>(slots_.size()); }
+
+  // whether `frame` can be copied into the textures as it is: in their
+  // format and at their size
+  bool accepts(const AVFrame* frame) const;
+
+  // Render thread. Locks a free texture and queues `frame` to be copied into
+  // it, the frame goes to ReleaseFrame afterwards. False if the frame is not
+  // accepted or every texture is busy, the caller still owns it then.
+  bool submit(AVFrame* frame);
+
+  // Render thread. The fallback of submit: waits for the copies in flight and
+  // uploads `frame` with SDL_UpdateYUVTexture or SDL_UpdateNVTexture into a
+  // texture that is not on screen. The caller keeps the frame.
+  void uploadNow(const AVFrame* frame);
+
+  // Render thread. Unlocks the textures whose copy finished and shows the
+  // newest of them. True if what current() returns changed.
+  bool collect();
+
+  // the texture to draw, nullptr before the first frame
+  SDL_Texture* current() const {
+    return shown_ >= 0 ? slots_[shown_].texture : nullptr;
+  }
+};
+}  // namespace ArcVP
+
+#endif  // TEXTURE_RING_H
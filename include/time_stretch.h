@@ -0,0 +1,77 @@
+//
+// Created by delta on 5/19/2025.
+//
+
+#ifndef TIME_STRETCH_H
+#define TIME_STRETCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ArcVP {
+
+// Window sizes of the time-stretch, in milliseconds.
+struct TimeStretchConfig {
+  // length of the pieces of input that are copied to the output
+  int sequence_ms = 40;
+  // crossfade between two pieces
+  int overlap_ms = 8;
+  // how far past its nominal position a piece may start, to line up with
+  // the end of the previous one
+  int seek_ms = 15;
+};
+
+// Changes the tempo of interleaved float audio without changing its pitch
+// (WSOLA). The input is cut into overlapping pieces taken `speed` times
+// further apart than they are written. Each piece starts at the offset within
+// the seek window whose first `overlap` frames best match the end of the
+// previous piece, and the two are crossfaded there.
+//
+// The offset search is the expensive part. It runs on SSE or AVX2 when the
+// CPU has them, picked at runtime.
+class TimeStretch {
+  int channels_ = 0;
+  // in frames
+  int sequence_ = 0, overlap_ = 0, seek_ = 0;
+  double speed_ = 1;
+  // fractional part of the input advance
+  double skip_carry_ = 0;
+  std::vector<float> input_;
+  // first frame of input_ that is still needed
+  size_t input_start_ = 0;
+  // tail of the last piece, crossfaded into the next one
+  std::vector<float> overlap_tail_;
+  bool has_tail_ = false;
+
+  int bestOffset(const float* candidates) const;
+
+ public:
+  void configure(int sample_rate, int channels, TimeStretchConfig config = {});
+
+  // output plays `speed` times faster than the input. 1 passes audio through
+  void setSpeed(double speed) { speed_ = speed; }
+
+  double speed() const { return speed_; }
+
+  bool active() const { return speed_ != 1; }
+
+  // whether input is held back, process() has to be called even at 1x then
+  bool pending() const { return has_tail_ || !input_.empty(); }
+
+  // appends the stretched output for `frames` frames of input to `out`. Up to
+  // sequence + seek frames are held back until more input arrives.
+  void process(const float* in, size_t frames, std::vector<float>& out);
+
+  // appends what is held back as is, at the end of the stream
+  void drain(std::vector<float>& out);
+
+  // forgets everything held back, after a seek
+  void reset();
+
+  // the correlation kernel picked for this CPU
+  static const char* kernelName();
+};
+}  // namespace ArcVP
+
+#endif  // TIME_STRETCH_H
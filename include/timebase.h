@@ -0,0 +1,32 @@
+//
+// Created by delta on 5/18/2025.
+//
+
+#ifndef TIMEBASE_H
+#define TIMEBASE_H
+extern "C" {
+#include <libavutil/rational.h>
+}
+
+#include <chrono>
+#include <cstdint>
+
+namespace ArcVP {
+
+// steady_clock in microseconds
+inline int64_t nowUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+inline int64_t ptsToTime(int64_t pts, AVRational timebase) {
+  return pts * 1000. * timebase.num / timebase.den;
+}
+
+inline int64_t timeToPts(int64_t milli, AVRational timebase) {
+  return milli / 1000. * timebase.den / timebase.num;
+}
+}  // namespace ArcVP
+
+#endif  // TIMEBASE_H
@@ -4,6 +4,8 @@
 #include <iostream>
 
 #include "player.h"
+#include "present_scheduler.h"
+#include "texture_ring.h"
 
 using namespace std::chrono;
 
@@ -41,7 +43,9 @@ SDL_Window* window = nullptr;
 
 SDL_Renderer* renderer = nullptr;
 
-SDL_Texture* videoTexture = nullptr;
+// textures the video is shown from, filled by an upload thread
+ArcVP::TextureRing videoTextures;
+
 
 AVFrame* frame = nullptr;
 
@@ -51,6 +55,12 @@ void handleResize() {
 }
 ArcVP::Player* arc = ArcVP::Player::instance();
 
+// set once the file is open and playback started
+bool playing = false;
+
+// how often the loop looks at the open progress until then
+constexpr int kOpenPollMs = 5;
+
 void presentFrame(AVFrame* frame) {
   auto [width, height] = arc->getWH();
 
@@ -103,13 +113,38 @@ void handle_event(SDL_Event const& event) {
       handleResize();
       break;
     case SDL_EVENT_KEY_DOWN:
-      handleKeyDown(window, arc, event);
+      if (playing) {
+        handleKeyDown(window, arc, event);
+      }
       break;
     default:
       break;
   }
 }
 
+void createVideoTextures() {
+  videoTextures.create(
+      renderer, state.src_width, state.src_height, arc->videoOutputFormat(),
+      arc->textureRingDepth(),
+      [](AVFrame* frame) { arc->releaseFrame(frame); },
+      ArcVP::ARCVP_EVENT_NEXTFRAME, &arc->stats().upload);
+}
+
+// the codecs are ready: size the video texture and start the workers
+void startPlaying() {
+  auto [width, height] = arc->getWH();
+  spdlog::info("w: {}, h: {}", width, height);
+  state.src_width = width;
+  state.src_height = height;
+
+  if (arc->hasVideo()) {
+    createVideoTextures();
+  }
+  handleResize();
+  arc->startPlayback();
+  playing = true;
+}
+
 int main() {
   spdlog::set_level(spdlog::level::debug);
 
@@ -167,17 +202,11 @@ int main() {
   SDL_Surface* surface =
       TTF_RenderText_Blended(font, text.c_str(), 0, textColor);
 
-  arc->open("test.mp4");
-
-  auto [width, height] = arc->getWH();
-  spdlog::info("w: {}, h: {}", width, height);
-  state.src_width = width;
-  state.src_height = height;
+  // the window keeps drawing while the file opens, playback starts as soon
+  // as the codecs are ready
+  arc->openAsync("test.mp4");
 
   SDL_Texture* textTexture = SDL_CreateTextureFromSurface(renderer, surface);
-  videoTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_YV12,
-                                   SDL_TEXTUREACCESS_STREAMING, state.src_width,
-                                   state.src_height);
 
   SDL_Rect dstRect;
   dstRect.x = 50;
@@ -186,14 +215,74 @@ int main() {
   dstRect.h = surface->h;
 
   handleResize();
-  arc->startPlayback();
 
+  ArcVP::PresentScheduler scheduler;
+  ArcVP::RedrawTracker redraw;
   SDL_Event event;
   while (!arc->sync_state_.should_exit) {
-    while (SDL_PollEvent(&event)) {
-      ImGui_ImplSDL3_ProcessEvent(&event);
-      handle_event(event);
+    if (!playing) {
+      ArcVP::OpenState open_state = arc->openState();
+      if (open_state == ArcVP::OpenState::Failed) {
+        spdlog::error("Unable to open the file");
+        break;
+      }
+      if (open_state >= ArcVP::OpenState::CodecsReady) {
+        startPlaying();
+        redraw.invalidate();
+      }
     }
+    // sleep until the next frame is due or input arrives, audio-only files
+    // just keep the panel going
+    int64_t next_present_ms = arc->nextPresentMs();
+    int64_t next_present_us = next_present_ms == AV_NOPTS_VALUE
+                                  ? AV_NOPTS_VALUE
+                                  : next_present_ms * 1000;
+    int timeout = !playing          ? kOpenPollMs
+                  : arc->hasVideo() ? scheduler.timeoutMs(
+                                          arc->getPlayedUs(), next_present_us,
+                                          arc->sync_state_.pause &&
+                                              !arc->pendingSeekFrame())
+                                    : scheduler.idle_ms;
+    if (SDL_WaitEventTimeout(&event, timeout)) {
+      do {
+        ImGui_ImplSDL3_ProcessEvent(&event);
+        handle_event(event);
+      } while (SDL_PollEvent(&event));
+      redraw.invalidate();
+    } else if (next_present_us != AV_NOPTS_VALUE && !arc->sync_state_.pause) {
+      scheduler.spinUntil(next_present_us, [] { return arc->getPlayedUs(); });
+    }
+
+    if (videoTextures.created() &&
+        videoTextures.depth() != arc->textureRingDepth()) {
+      // switched between double and triple buffering, the next frame shows
+      // up in the new ring
+      createVideoTextures();
+      redraw.invalidate();
+    }
+    // while paused only the frame at a seek target comes through
+    if (videoTextures.created() &&
+        (!arc->sync_state_.pause || arc->pendingSeekFrame())) {
+      auto frame = arc->getVideoFrame();
+      // copied on the upload thread, which wakes us when it is done. A frame
+      // the ring can not take is uploaded here as before.
+      if (frame && !videoTextures.submit(frame)) {
+        arc->stats().sync_uploads++;
+        videoTextures.uploadNow(frame);
+        arc->releaseFrame(frame);
+      }
+    }
+    bool uploaded = videoTextures.collect();
+    if (uploaded) {
+      redraw.invalidate(1);
+    }
+    if (arc->renderOnDemand() &&
+        !redraw.shouldDraw(ArcVP::nowUs())) {
+      arc->stats().skipped_redraws++;
+      continue;
+    }
+    arc->stats().redraws++;
+
     // Start the Dear ImGui frame
     ImGui_ImplSDLRenderer3_NewFrame();
     ImGui_ImplSDL3_NewFrame();
@@ -205,28 +294,31 @@ int main() {
     ImGui::SetNextWindowPos(windowPos, ImGuiCond_Once);  // or ImGuiCond_Always
     ImGui::SetNextWindowSize(windowSize, ImGuiCond_Once);
     ImGui::Begin("Arc VP");
-    if (!arc->sync_state_.pause) {
-      auto frame = arc->getVideoFrame();
-      if (frame) {
-        SDL_UpdateYUVTexture(videoTexture, nullptr, frame->data[0],
-                     frame->linesize[0],                   // Y plane
-                     frame->data[1], frame->linesize[1],   // U plane
-                     frame->data[2], frame->linesize[2]);  // V plane
-        av_frame_free(&frame);
-      }
+    if (auto videoTexture = videoTextures.current()) {
+      ImGui::Image((ImTextureID)videoTexture, ImVec2(state.window_width,state.window_height));
     }
-
-    ImGui::Image((ImTextureID)videoTexture, ImVec2(state.window_width,state.window_height));
     ImGui::End();
 
-    arc->controlPanel();
+    if (playing) {
+      arc->controlPanel();
+    } else {
+      ImGui::Begin("ArcVP Control Panel");
+      ImGui::Text("Opening: %s", ArcVP::openStateName(arc->openState()));
+      ImGui::End();
+    }
+    auto present_start = steady_clock::now();
     ImGui::Render();
     SDL_RenderClear(renderer);
     ImGui_ImplSDLRenderer3_RenderDrawData(ImGui::GetDrawData(),renderer);
     SDL_RenderPresent(renderer);
-    SDL_Delay(10);
+    arc->stats().present.record(ArcVP::elapsedUs(present_start));
+    if (uploaded) {
+      arc->framePresented();
+    }
   }
 
+  // the ring hands frames back to the player
+  videoTextures.destroy();
   arc->exit();
   ImGui_ImplSDLRenderer3_Shutdown();
   ImGui_ImplSDL3_Shutdown();
@@ -4,137 +4,254 @@
 #include "player.h"
 namespace ArcVP {
 AVFrame* Player::decodeAudioFrame() {
-  AVFrame* frame = av_frame_alloc();
+  AVFrame* frame = frame_pool_.acquire();
   int ret = 0;
+  // time spent in the codec, not waiting for packets
+  int64_t codec_us = 0;
   while (true) {
+    auto start = steady_clock::now();
     ret = avcodec_receive_frame(media_.audio_codec_context_, frame);
+    codec_us += elapsedUs(start);
     if (ret == 0) {
       break;
     }
+    if (ret == AVERROR_EOF && audio_decode_worker_.serial == audio_decode_worker_.codec_serial) {
+      // fully drained, and no seek to go on from
+      frame_pool_.release(frame);
+      return nullptr;
+    }
     if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-      // spdlog::debug("audio thread receive packet with lock");
-      if (audio_decode_worker_.packet_chan.empty()) {
-        av_frame_free(&frame);
+      AVPacket* pkt = nullptr;
+      int serial = 0;
+      if (!audio_decode_worker_.packet_chan.pop(pkt, serial)) {
+        frame_pool_.release(frame);
         return nullptr;
       }
-      auto pkt = audio_decode_worker_.packet_chan.front();
-      audio_decode_worker_.packet_chan.pop_front();
-      // spdlog::debug("packet acquired");
+      demux_worker_.wake();
+      if (serial != audio_decode_worker_.codec_serial) {
+        takeAudioTrackSwitch(serial);
+        restartDecoder(audio_decode_worker_, media_.audio_codec_context_, serial);
+      }
       if (!pkt) {
-        spdlog::info("Audio Consumer exited due to closed channel");
-        audio_decode_worker_.status = WorkerStatus::Exiting;
-        av_frame_free(&frame);
-        return nullptr;
+        spdlog::info("Audio packet queue drained");
+        // enter draining mode, the frames still held by the codec follow
+        avcodec_send_packet(media_.audio_codec_context_, nullptr);
+        continue;
       }
+      start = steady_clock::now();
       ret = avcodec_send_packet(media_.audio_codec_context_, pkt);
+      codec_us += elapsedUs(start);
       if (ret < 0) {
         spdlog::error("Error sending packet to codec: {}", av_err2str(ret));
       }
-      av_packet_free(&pkt);
+      packet_pool_.release(pkt);
     } else {
       spdlog::error("Unable to receive audio frame: {}", av_err2str(ret));
-      av_frame_free(&frame);
+      frame_pool_.release(frame);
+      return nullptr;
     }
   }
+  stats_.audio_decode.record(codec_us);
   return frame;
 }
+// on the audio decode thread, when the packets of `serial` start arriving.
+// Takes over the codec of a track the demuxer switched to at or before it.
+void Player::takeAudioTrackSwitch(int serial) {
+  TrackSwitch track;
+  {
+    std::scoped_lock lk{track_switch_mtx_};
+    if (!switched_track_.codec_context || serial < switched_track_.serial) {
+      return;
+    }
+    track = std::exchange(switched_track_, {});
+  }
+  std::scoped_lock lk{media_.audio_codec_mtx_};
+  avcodec_free_context(&media_.audio_codec_context_);
+  media_.audio_codec_context_ = track.codec_context;
+  media_.audio_codec_ = track.codec;
+  media_.audio_stream_ = media_.format_context_->streams[track.stream_index];
+  media_.audio_codec_params_ = media_.audio_stream_->codecpar;
+  spdlog::info("Audio decoder switched to stream {} ('{}')",
+               track.stream_index, track.codec->name);
+}
+
 void Player::audioDecodeThreadWorker() {
   while (!sync_state_.should_exit) {
-    std::unique_lock lk{audio_decode_worker_.mtx};
     AVFrame* frame=decodeAudioFrame();
     if (!frame) {
       break;
     }
-    lk.unlock();
-
-    // spdlog::debug("audio try lock audio queue");
+    int serial = audio_decode_worker_.codec_serial;
+    if (serial != audio_decode_worker_.serial) {
+      // a seek is on its way
+      frame_pool_.release(frame);
+      continue;
+    }
     int64_t present_ms = ptsToTime(frame->pts, media_.audio_stream_->time_base);
+    auto& preroll_ms = audio_decode_worker_.preroll_ms;
+    if (preroll_ms != AV_NOPTS_VALUE) {
+      if (present_ms < preroll_ms) {
+        frame_pool_.release(frame);
+        continue;
+      }
+      preroll_ms = AV_NOPTS_VALUE;
+      auto& seek_started_us = audio_decode_worker_.seek_started_us;
+      if (seek_started_us != 0) {
+        stats_.seek_first_frame.record(nowUs() - seek_started_us);
+        seek_started_us = 0;
+      }
+    }
+
+    if (!hasVideo()) {
+      firstFrameReady();
+    }
+
     // SDL 会从 stream 中取数据
+    auto resample_start = steady_clock::now();
     resampleAudioFrame(frame);
+    stats_.resample.record(elapsedUs(resample_start));
 
-    while (!sync_state_.should_exit &&
-           SDL_GetAudioStreamAvailable(audio_stream) > 114514) {
-      std::this_thread::sleep_for(10ms);
+    auto samples = reinterpret_cast<const float*>(audio_buffer_.data());
+    size_t sample_count = audio_buffer_.size() / sizeof(float);
+    if (sink_config_.null_audio) {
+      waitNullAudioSink();
+      if (serial == audio_decode_worker_.serial) {
+        sync_state_.sample_count_ += sample_count / audio_layout_.nb_channels;
+      }
+    } else {
+      if (serial != stretch_serial_) {
+        stretch_.reset();
+        stretch_serial_ = serial;
+      }
+      stretch_.setSpeed(stretch_speed_);
+      if (stretch_.active() || stretch_.pending()) {
+        int channels = audio_layout_.nb_channels;
+        stretch_out_.clear();
+        stretch_.process(samples, sample_count / channels, stretch_out_);
+        samples = stretch_out_.data();
+        sample_count = stretch_out_.size();
+      }
+      // blocks while the ring is full, the device callback drains it. A seek
+      // flushes the ring to a new serial and the rest of this frame is dropped
+      pcm_ring_.write(samples, sample_count, serial);
     }
-    // spdlog::debug("avail: {}",SDL_GetAudioStreamAvailable(audio_stream));
-    SDL_PutAudioStreamData(audio_stream, audio_buffer_.data(),
-                           audio_buffer_.size());
-    SDL_FlushAudioStream(audio_stream);
-    sync_state_.sample_count_ +=
-        audio_buffer_.size() / sizeof(float) /
-        media_.audio_codec_params_->ch_layout.nb_channels;
-    av_frame_free(&frame);
+    frame_pool_.release(frame);
+  }
+  if (stretch_.pending() && !sync_state_.should_exit) {
+    stretch_out_.clear();
+    stretch_.drain(stretch_out_);
+    pcm_ring_.write(stretch_out_.data(), stretch_out_.size(), stretch_serial_);
+  }
+  pcm_ring_.close();
+  if (!hasVideo()) {
+    firstFrameReady();
   }
-end:
   spdlog::info("Audio decode thread exited");
 }
 
-bool Player::resampleAudioFrame(AVFrame* frame) {
-  static SwrContext* ctx = nullptr;
-  if (!ctx) {
-    swr_alloc_set_opts2(&ctx, &media_.audio_codec_params_->ch_layout,
-                        AV_SAMPLE_FMT_FLT,
-                        media_.audio_codec_params_->sample_rate,
-                        &media_.audio_codec_params_->ch_layout,
-                        media_.audio_codec_context_->sample_fmt,
-                        media_.audio_codec_params_->sample_rate, 0, nullptr);
+// how far the null sink runs ahead of the wall clock, about what an audio
+// device keeps buffered
+constexpr int64_t kNullSinkLeadMs = 200;
 
-    swr_init(ctx);
+// a realtime null sink holds the decoder back like a full device buffer would,
+// otherwise it takes everything at once. It plays on the steady clock.
+void Player::waitNullAudioSink() {
+  if (!sink_config_.realtime) {
+    return;
+  }
+  int rate = audio_rate_;
+  // a closed ring means close() is waiting for this thread
+  while (!sync_state_.should_exit && !pcm_ring_.closed()) {
+    int64_t queued_us =
+        av_rescale_q(sync_state_.sample_count_, {1, rate}, {1, 1000000});
+    int64_t ahead_us = queued_us - clock_.timeUs() - kNullSinkLeadMs * 1000;
+    if (!sync_state_.pause && ahead_us <= 0) {
+      return;
+    }
+    std::this_thread::sleep_for(sync_state_.pause
+                                    ? 10ms
+                                    : microseconds(std::min<int64_t>(
+                                          ahead_us, 10'000)));
   }
-  int outSamples = av_rescale_rnd(
-      swr_get_delay(ctx, media_.audio_codec_context_->sample_rate) +
-          frame->nb_samples,
-      media_.audio_codec_context_->sample_rate,
-      media_.audio_codec_context_->sample_rate, AV_ROUND_UP);
+}
 
-  audio_buffer_.resize(outSamples *
-                       media_.audio_codec_context_->ch_layout.nb_channels *
-                       sizeof(float));
-  uint8_t* outBuffer = audio_buffer_.data();
-  swr_convert(ctx, &outBuffer, outSamples, frame->data, frame->nb_samples);
-  return true;
+bool Player::resampleAudioFrame(AVFrame* frame) {
+  return resampler_.convert(frame, audio_buffer_) >= 0;
 }
 
+// the audio stream's get callback, runs on SDL's audio thread whenever the
+// device needs more data
 void audioCallback(void* userdata, SDL_AudioStream* stream,
                    int additional_amount, int total_amount) {
-  auto arc = static_cast<Player*>(userdata);
-  static int64_t audioPos = 0;
-  std::memset(stream, 0, total_amount);
-  // while (len > 0) {
-  //   int bytesCopied = 0;
-  //   if (audioPos >= arc->audio_buffer_.size()) {
-  //     auto [frame,present_ms] = arc->tryFetchAudioFrame();
-  //     if (!frame) {
-  //       spdlog::info("AudioCallback: no available frame");
-  //       return;
-  //     }
-  //     // auto t =
-  //     //     ptsToTime(frame->pts,
-  //     //     arc->media_context_.audio_stream_->time_base);
-  //     // spdlog::debug("playing audio frame: {}ms",t);
-  //
-  //     audioPos = 0;
-  //     arc->resampleAudioFrame(frame);
-  //     int64_t played_ms=arc->getPlayedMs();
-  //     int64_t delta_time=present_ms-played_ms;
-  //     if (delta_time>50) {
-  //       int64_t
-  //       count=(delta_time/1000.)*arc->media_.audio_codec_params_->sample_rate*2*4;
-  //       arc->audio_buffer_.insert(arc->audio_buffer_.begin(),count,0);
-  //     }
-  //     // arc->audioSyncTo(frame,present_ms);
-  //   }
-  //   bytesCopied = std::min(arc->audio_buffer_.size() - audioPos,
-  //                          static_cast<std::size_t>(len));
-  //   memcpy(stream, arc->audio_buffer_.data() + audioPos, bytesCopied);
-  //   len -= bytesCopied;
-  //   stream += bytesCopied;
-  //   audioPos += bytesCopied;
-  //   std::scoped_lock sync_lock{arc->sync_state_.mtx_};
-  //   arc->sync_state_.sample_count_ +=
-  //       bytesCopied / sizeof(float) /
-  //       arc->media_.audio_codec_params_->ch_layout.nb_channels;
-  // }
+  static_cast<Player*>(userdata)->fillAudioStream(stream, additional_amount);
+}
+
+void Player::fillAudioStream(SDL_AudioStream* stream, int bytes) {
+  int channels = audio_layout_.nb_channels;
+  double media_per_sample = stretch_speed_;
+  size_t wanted = bytes / sizeof(float);
+  wanted -= wanted % channels;
+  while (wanted > 0) {
+    size_t chunk = std::min(wanted, callback_pcm_.size());
+    size_t got = pcm_ring_.read(callback_pcm_.data(), chunk);
+    if (got > 0) {
+      drain_until_us_ = 0;
+      SDL_PutAudioStreamData(stream, callback_pcm_.data(),
+                             got * sizeof(float));
+      // sample_count_ is in media samples, stretched audio has more or less
+      double media = got / channels * media_per_sample + callback_media_carry_;
+      auto whole = static_cast<int64_t>(media);
+      callback_media_carry_ = media - whole;
+      sync_state_.sample_count_ += whole;
+    }
+    if (got < chunk) {
+      // SDL plays silence for the rest. After the last frame the decoder
+      // closes the ring and that is not an underrun, video goes on without
+      // an audio clock.
+      if (fastForward() != DegradationLevel::None) {
+        // muted
+      } else if (!pcm_ring_.closed()) {
+        stats_.audio_underruns++;
+      } else {
+        clock_.useSteady();
+        if (!hasVideo() && audioDrained(stream)) {
+          sync_state_.should_exit = true;
+        }
+      }
+      break;
+    }
+    wanted -= got;
+  }
+  // the sample being heard: everything handed to SDL minus what still waits
+  // in the stream and in the device buffer
+  int rate = audio_rate_;
+  int64_t queued = SDL_GetAudioStreamQueued(stream) /
+                   (sizeof(float) * channels) * media_per_sample;
+  int64_t device = audio_device_.spec.freq > 0
+                       ? av_rescale(audio_device_.sample_frames, rate,
+                                    audio_device_.spec.freq) * speed
+                       : 0;
+  int64_t heard = sync_state_.sample_count_ - queued - device;
+  clock_.reportAudio(av_rescale_q(heard, {1, rate}, {1, 1000000}));
+}
+
+// Whether the end of an audio-only file was heard. The last samples handed to
+// SDL still wait in the stream and then for a device period in its buffer,
+// exiting before would cut them off.
+bool Player::audioDrained(SDL_AudioStream* stream) {
+  if (SDL_GetAudioStreamQueued(stream) > 0) {
+    drain_until_us_ = 0;
+    return false;
+  }
+  int64_t now = nowUs();
+  if (drain_until_us_ == 0) {
+    int64_t period_us = audio_device_.spec.freq > 0
+                            ? int64_t(audio_device_.sample_frames) * 1000000 /
+                                  audio_device_.spec.freq
+                            : 0;
+    drain_until_us_ = now + period_us;
+  }
+  return now >= drain_until_us_;
 }
 
 bool Player::setupAudioDevice() {
@@ -146,7 +263,8 @@ bool Player::setupAudioDevice() {
   if (audio_device_.id == 0) {
     return false;
   }
-  SDL_GetAudioDeviceFormat(audio_device_.id, &audio_device_.spec, nullptr);
+  SDL_GetAudioDeviceFormat(audio_device_.id, &audio_device_.spec,
+                           &audio_device_.sample_frames);
   audio_device_.name = SDL_GetAudioDeviceName(audio_device_.id);
   if (!audio_device_.name) {
     spdlog::error("Unable to get audio device name: {}", SDL_GetError());
@@ -165,14 +283,13 @@ void Player::audioSyncTo(AVFrame* frame, int64_t present_ms) {
     return;
   }
   if (deltaTime > 0) {
-    int64_t samples =
-        deltaTime * media_.audio_codec_params_->sample_rate / 1000.;
+    int64_t samples = deltaTime * audio_rate_ / 1000.;
     while (samples--) {
       audio_buffer_.push_back(0);
     }
     spdlog::info("Audio: Sync to: {}ms", deltaTime);
   } else {
-    auto sampleRate = media_.audio_codec_params_->sample_rate;
+    auto sampleRate = audio_rate_;
     int64_t samples = std::abs(deltaTime) * sampleRate / 1000.;
     auto end = samples > audio_buffer_.size() ? audio_buffer_.end()
                                               : audio_buffer_.begin() + samples;
@@ -0,0 +1,77 @@
+//
+// Created by delta on 5/18/2025.
+//
+
+#include "audio_resampler.h"
+
+#include <spdlog/spdlog.h>
+
+extern "C" {
+#include <libavutil/error.h>
+#include <libavutil/mathematics.h>
+}
+
+namespace ArcVP {
+
+void AudioResampler::setOutput(int rate, const AVChannelLayout& layout) {
+  reset();
+  out_rate_ = rate;
+  av_channel_layout_uninit(&out_layout_);
+  av_channel_layout_copy(&out_layout_, &layout);
+}
+
+bool AudioResampler::setup(const AVFrame* frame) {
+  reset();
+  int out_rate = out_rate_ > 0 ? out_rate_ : frame->sample_rate;
+  const AVChannelLayout* out_layout =
+      out_layout_.nb_channels > 0 ? &out_layout_ : &frame->ch_layout;
+  int ret = swr_alloc_set_opts2(&ctx_, out_layout, AV_SAMPLE_FMT_FLT,
+                                out_rate, &frame->ch_layout,
+                                static_cast<AVSampleFormat>(frame->format),
+                                frame->sample_rate, 0, nullptr);
+  if (ret < 0 || (ret = swr_init(ctx_)) < 0) {
+    spdlog::error("Unable to set up resampler: {}", av_err2str(ret));
+    swr_free(&ctx_);
+    return false;
+  }
+  in_format_ = static_cast<AVSampleFormat>(frame->format);
+  in_rate_ = frame->sample_rate;
+  av_channel_layout_copy(&in_layout_, &frame->ch_layout);
+  return true;
+}
+
+void AudioResampler::reset() {
+  swr_free(&ctx_);
+  av_channel_layout_uninit(&in_layout_);
+  in_format_ = AV_SAMPLE_FMT_NONE;
+  in_rate_ = 0;
+}
+
+int AudioResampler::convert(const AVFrame* frame, std::vector<uint8_t>& out) {
+  if (!ctx_ || frame->format != in_format_ ||
+      frame->sample_rate != in_rate_ ||
+      av_channel_layout_compare(&frame->ch_layout, &in_layout_) != 0) {
+    if (!setup(frame)) {
+      out.clear();
+      return AVERROR(EINVAL);
+    }
+  }
+  int out_rate = out_rate_ > 0 ? out_rate_ : in_rate_;
+  int channels = out_layout_.nb_channels > 0 ? out_layout_.nb_channels
+                                             : frame->ch_layout.nb_channels;
+  int max_samples = av_rescale_rnd(
+      swr_get_delay(ctx_, in_rate_) + frame->nb_samples, out_rate, in_rate_,
+      AV_ROUND_UP);
+  out.resize(max_samples * channels * sizeof(float));
+  uint8_t* out_data = out.data();
+  int samples = swr_convert(ctx_, &out_data, max_samples, frame->extended_data,
+                            frame->nb_samples);
+  if (samples < 0) {
+    spdlog::error("Unable to resample audio frame: {}", av_err2str(samples));
+    out.clear();
+    return samples;
+  }
+  out.resize(samples * channels * sizeof(float));
+  return samples;
+}
+}  // namespace ArcVP
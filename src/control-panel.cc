@@ -6,7 +6,9 @@
 
 
 static int speedIndex = 4;
-static float speeds[] = {0.125, 0.25, 0.5, 0.75, 1, 1.25, 1.5, 1.75, 2};
+// past 2x audio is muted and video decoding thins out, see fastForwardLevel
+static float speeds[] = {0.125, 0.25, 0.5, 0.75, 1,  1.25, 1.5,
+                         1.75,  2,    4,   8,    16, 32};
 
 float getNextSpeedDown() {
   if (speedIndex > 0) {
@@ -27,16 +29,35 @@ void Player::setPlaybackSpeed(float speed) {
   spdlog::debug("settings speed to: {}",speed);
   this->speed=speed;
   pause();
-  SDL_AudioSpec new_spec;
-  new_spec.channels=media_.audio_codec_params_->ch_layout.nb_channels;
-  new_spec.format=SDL_AUDIO_F32;
-  new_spec.freq=media_.audio_codec_params_->sample_rate*speed;
-  SDL_SetAudioStreamFrequencyRatio(audio_stream,speed);
+  DegradationLevel fast_forward = fastForwardLevel(speed);
+  bool was_muted = fastForward() != DegradationLevel::None;
+  bool muted = fast_forward != DegradationLevel::None;
+  fast_forward_step_ms_ = speed * 1000 / kFastForwardFps;
+  fast_forward_level_ = static_cast<int>(fast_forward);
+  bool stretch = !muted && audio_output_config_.preserve_pitch;
+  float stretch_speed = stretch ? speed : 1;
+  bool restretch = hasAudio() && stretch_speed != stretch_speed_;
+  stretch_speed_ = stretch_speed;
+  if (audio_stream) {
+    SDL_SetAudioStreamFrequencyRatio(audio_stream,muted || stretch ? 1 : speed);
+  }
+  clock_.setSpeed(speed);
+  if (muted && !was_muted) {
+    clock_.useSteady();
+  } else if (!muted && was_muted && audio_stream) {
+    clock_.useAudio();
+  }
   unpause();
+  if (muted != was_muted || restretch) {
+    // audio stops or starts, and what is queued was read for the other mode.
+    // Or the samples queued were stretched at the old speed, counting them at
+    // the new one would put the audio clock off for good.
+    seekTo(getPlayedMs(), muted ? SeekMode::Keyframe : seek_mode_);
+  }
 }
 
 void Player::controlPanel() {
-  int totalSeconds=ptsToTime(media_.video_stream_->duration,media_.video_stream_->time_base)/1000.;
+  int totalSeconds=durationMs()/1000;
   int totalMinutes = totalSeconds / 60;
   totalSeconds %= 60;
   int totalHour = totalMinutes / 60;
@@ -46,7 +67,8 @@ void Player::controlPanel() {
   curSeconds %= 60;
   int curHour = curMinutes / 60;
   curMinutes %= 60;
-  double playback_progress=curSeconds*1./totalSeconds;
+  double playback_progress=
+      durationMs() > 0 ? getPlayedMs() / double(durationMs()) : 0;
   // spdlog::debug("total: {}, progress: {}",totalSeconds,playback_progress);
   ImGui::Begin("ArcVP Control Panel");
 
@@ -65,9 +87,137 @@ void Player::controlPanel() {
   }
   ImGui::SameLine();
   ImGui::Text("Speed: %.2f", speed);
+  if (fastForward() != DegradationLevel::None) {
+    ImGui::SameLine();
+    ImGui::Text("(muted, %s)", degradationLevelName(fastForward()));
+  }
+  if (audio_stream) {
+    if (ImGui::Checkbox("Preserve pitch",
+                        &audio_output_config_.preserve_pitch)) {
+      setPlaybackSpeed(speed);
+    }
+    ImGui::SameLine();
+    ImGui::Text("(time-stretch: %s)", TimeStretch::kernelName());
+  }
+  if (audioTracks().size() > 1) {
+    auto label = [](const AudioTrack& track) {
+      return fmt::format(
+          "#{} {}{}{} ({}, {} ch)", track.stream_index,
+          track.language.empty() ? "und" : track.language,
+          track.title.empty() ? "" : " - ", track.title, track.codec,
+          track.channels);
+    };
+    std::string current;
+    for (const AudioTrack& track : audioTracks()) {
+      if (track.stream_index == audioTrack()) {
+        current = label(track);
+      }
+    }
+    if (ImGui::BeginCombo("Audio track", current.c_str())) {
+      for (const AudioTrack& track : audioTracks()) {
+        bool selected = track.stream_index == audioTrack();
+        if (ImGui::Selectable(label(track).c_str(), selected) && !selected) {
+          selectAudioTrack(track.stream_index);
+        }
+        if (selected) {
+          ImGui::SetItemDefaultFocus();
+        }
+      }
+      ImGui::EndCombo();
+    }
+  }
   ImGui::ProgressBar(playback_progress);
+  ImGui::Text("Opened: codecs after %.1f ms, first frame after %.1f ms, "
+              "%d probes%s",
+              open_timings_.codecs_ready_us / 1000.,
+              open_timings_.first_frame_us / 1000.,
+              open_timings_.probe_attempts.load(),
+              open_timings_.cached_probe ? " (cached)" : "");
   ImGui::Text("Playback Time: %02d:%02d:%02d / %02d:%02d:%02d", curHour,
               curMinutes, curSeconds, totalHour, totalMinutes, totalSeconds);
+  if (media_.video_codec_context_) {
+    ImGui::Text("Video decode: %d threads (%s), %.1f fps",
+                media_.video_codec_context_->thread_count,
+                threadTypeName(media_.video_codec_context_->active_thread_type),
+                video_decode_worker_.decode_rate.rate());
+  }
+  if (media_.video_codec_context_) {
+    AVPixelFormat decoded = media_.video_codec_context_->pix_fmt;
+    ImGui::Text("Pixel format: %s to %s, %s (%s), %.2f ms mean",
+                av_get_pix_fmt_name(decoded),
+                av_get_pix_fmt_name(pixel_converter_.output()),
+                pixel_converter_.pathName(decoded),
+                PixelConverter::kernelName(), stats_.convert.mean() / 1000.);
+  }
+  bool exact_seek = seek_mode_ == SeekMode::Exact;
+  if (ImGui::Checkbox("Exact seek", &exact_seek)) {
+    seek_mode_ = exact_seek ? SeekMode::Exact : SeekMode::Keyframe;
+  }
+  ImGui::SameLine();
+  ImGui::Text("%.1f ms to first frame, %lld frames prerolled, %lld coalesced",
+              stats_.seek_first_frame.mean() / 1000.,
+              static_cast<long long>(stats_.preroll_frames),
+              static_cast<long long>(stats_.coalesced_seeks));
+  ImGui::Text("Present error: %.2f ms mean, %lld dropped",
+              stats_.present_error.mean() / 1000.,
+              static_cast<long long>(stats_.dropped_frames));
+  if (media_.video_codec_context_) {
+    DegradationConfig config = degradation_.config();
+    if (ImGui::Checkbox("Adaptive quality", &config.enabled)) {
+      degradation_.configure(config);
+    }
+    ImGui::SameLine();
+    ImGui::Text("Degradation: %s",
+                degradationLevelName(degradation_.level()));
+  }
+  if (clock_.master() == MediaClock::Master::Audio) {
+    ImGui::Text("Clock: audio, A/V offset %.2f ms mean",
+                stats_.av_offset.mean() / 1000.);
+  } else {
+    ImGui::Text("Clock: steady");
+  }
+  ImGui::Checkbox("Render on demand", &render_on_demand_);
+  ImGui::SameLine();
+  ImGui::Text("%lld drawn, %lld skipped",
+              static_cast<long long>(stats_.redraws),
+              static_cast<long long>(stats_.skipped_redraws));
+  if (hasVideo()) {
+    bool triple = texture_ring_depth_ == 3;
+    if (ImGui::Checkbox("Triple buffering", &triple)) {
+      texture_ring_depth_ = triple ? 3 : 2;
+    }
+    ImGui::SameLine();
+    ImGui::Text("upload %.2f ms, present %.2f ms mean, %lld on render thread",
+                stats_.upload.mean() / 1000., stats_.present.mean() / 1000.,
+                static_cast<long long>(stats_.sync_uploads));
+  }
+  auto& video_queue = video_decode_worker_.output_queue;
+  ImGui::Text("Video queue: %zu/%zu frames, %.1f MB, %lld ms",
+              video_queue.size(), video_queue.capacity(),
+              video_queue.bytes / (1024. * 1024.),
+              static_cast<long long>(video_queue.duration_ms));
+  if (audio_stream && audio_rate_ > 0) {
+    int64_t samples_per_second =
+        int64_t(audio_rate_) * audio_layout_.nb_channels;
+    ImGui::Text("Audio ring: %lld/%lld ms, %lld underruns",
+                static_cast<long long>(pcm_ring_.size() * 1000 /
+                                       samples_per_second),
+                static_cast<long long>(pcm_ring_.capacity() * 1000 /
+                                       samples_per_second),
+                static_cast<long long>(stats_.audio_underruns));
+  }
+  ImGui::Text("Frame pool: %lld hits, %lld misses",
+              static_cast<long long>(frame_pool_.hits()),
+              static_cast<long long>(frame_pool_.misses()));
+  ImGui::Text("Packet pool: %lld hits, %lld misses",
+              static_cast<long long>(packet_pool_.hits()),
+              static_cast<long long>(packet_pool_.misses()));
+  if (frame_arena_) {
+    ImGui::Text("Frame arena: %zu blocks of %zu KB, %zu idle, %lld reuses",
+                frame_arena_->blocks(), frame_arena_->blockSize() / 1024,
+                frame_arena_->idle(),
+                static_cast<long long>(frame_arena_->reuses()));
+  }
   ImGui::End();
 }
 }  // namespace ArcVP
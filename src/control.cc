@@ -4,33 +4,78 @@
 #include "player.h"
 namespace ArcVP {
 void Player::startPlayback() {
-  if (audio_device_.id==-1) {
-    setupAudioDevice();
+  if (!sink_config_.null_audio && hasAudio()) {
+    int rate = audio_rate_;
+    int channels = audio_layout_.nb_channels;
+    int latency_ms = std::clamp(audio_output_config_.target_latency_ms,
+                                AudioOutputConfig::kMinLatencyMs,
+                                AudioOutputConfig::kMaxLatencyMs);
+    if (audio_device_.id==-1) {
+      // a device period of half the target latency, the ring holds the rest
+      SDL_SetHint(SDL_HINT_AUDIO_DEVICE_SAMPLE_FRAMES,
+                  std::to_string(rate * latency_ms / 2000).c_str());
+      setupAudioDevice();
+    }
+    spdlog::info("default audio device: {}", audio_device_.name);
+    // we feed the decoder's rate and layout as float, SDL converts to the
+    // device format
+    SDL_AudioSpec src_spec{SDL_AUDIO_F32, channels, rate};
+    audio_stream=SDL_CreateAudioStream(&src_spec,&audio_device_.spec);
+    if (!audio_stream) {
+      spdlog::error("fail to get audio stream: {}",SDL_GetError());
+      std::exit(1);
+    }
+    size_t ring_samples = size_t(rate) * channels * latency_ms / 2000;
+    pcm_ring_.reset(ring_samples);
+    callback_pcm_.resize(ring_samples);
+    stretch_.configure(rate, channels);
+    SDL_SetAudioStreamGetCallback(audio_stream, audioCallback, this);
+    SDL_BindAudioStream(audio_device_.id,audio_stream);
+    spdlog::info("Audio output: {}ms target latency, {} samples buffered",
+                 latency_ms, ring_samples);
+    // runs on past a report for at most one device period
+    clock_.reset(MediaClock::Master::Audio,
+                 audio_device_.spec.freq > 0
+                     ? int64_t(audio_device_.sample_frames) * 1000000 /
+                           audio_device_.spec.freq
+                     : latency_ms * 1000 / 2);
+  } else {
+    clock_.reset(MediaClock::Master::Steady);
   }
-  spdlog::info("default audio device: {}", audio_device_.name);
-  audio_stream=SDL_CreateAudioStream(&audio_device_.spec,&audio_device_.spec);
-  if (!audio_stream) {
-    spdlog::error("fail to get audio stream: {}",SDL_GetError());
-    std::exit(1);
-  }
-  SDL_BindAudioStream(audio_device_.id,audio_stream);
 
 
-  audio_decode_worker_.spawn([this] { this->audioDecodeThreadWorker(); });
-  video_decode_worker_.spawn([this] { this->videoDecodeThreadWorker(); });
+  // only the streams the file has, a missing one never gets a thread
+  if (hasAudio()) {
+    audio_decode_worker_.spawn([this] { this->audioDecodeThreadWorker(); });
+  }
+  if (hasVideo()) {
+    video_decode_worker_.spawn([this] { this->videoDecodeThreadWorker(); });
+  }
 
-  sync_state_.pause=false;
-  SDL_ResumeAudioDevice(audio_device_.id);
+  // pre-roll: the clock starts once the first frame is decoded, not while
+  // the decoders warm up, so playback does not open with late frames
+  play_on_first_frame_ = true;
+  if (open_state_ != OpenState::CodecsReady &&
+      play_on_first_frame_.exchange(false)) {
+    unpause();
+  }
 }
 
 void Player::pause() {
   sync_state_.pause=true;
-  SDL_PauseAudioDevice(audio_device_.id);
+  clock_.pause();
+  if (audio_stream) {
+    SDL_PauseAudioDevice(audio_device_.id);
+  }
 }
 
 void Player::unpause() {
+  if (audio_stream) {
+    SDL_ResumeAudioDevice(audio_device_.id);
+  }
+  clock_.resume();
+  degradation_.resetWindow();
   sync_state_.pause=false;
-  SDL_ResumeAudioDevice(audio_device_.id);
 }
 
 }  // namespace ArcVP
\ No newline at end of file
@@ -0,0 +1,160 @@
+//
+// Created by delta on 5/15/2025.
+//
+
+#include "frame_arena.h"
+
+#include <spdlog/spdlog.h>
+
+extern "C" {
+#include <libavutil/imgutils.h>
+#include <libavutil/mem.h>
+#include <libavutil/pixdesc.h>
+}
+
+namespace ArcVP {
+namespace {
+constexpr size_t kAlign = 64;
+
+size_t alignUp(size_t n) { return (n + kAlign - 1) & ~(kAlign - 1); }
+}  // namespace
+
+FrameArena* FrameArena::create(AVCodecContext* ctx, int prealloc) {
+  if (!(ctx->codec->capabilities & AV_CODEC_CAP_DR1)) {
+    spdlog::info("Decoder '{}' does not support custom buffers",
+                 ctx->codec->name);
+    return nullptr;
+  }
+  const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(ctx->pix_fmt);
+  if (!desc || ctx->width <= 0 || ctx->height <= 0 ||
+      desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL |
+                     AV_PIX_FMT_FLAG_BITSTREAM)) {
+    return nullptr;
+  }
+  auto arena = new FrameArena(ctx->width, ctx->height, ctx->pix_fmt);
+  if (!arena->layout(ctx)) {
+    delete arena;
+    return nullptr;
+  }
+  std::scoped_lock lk{arena->mtx_};
+  for (int i = 0; i < prealloc; i++) {
+    uint8_t* block = arena->takeBlock();
+    if (!block) {
+      break;
+    }
+    arena->free_.push_back(block);
+  }
+  spdlog::info("Frame arena for {}x{} {}: {} blocks of {} bytes", ctx->width,
+               ctx->height, desc->name, arena->blocks_.size(),
+               arena->block_size_);
+  return arena;
+}
+
+FrameArena::~FrameArena() {
+  for (uint8_t* block : blocks_) {
+    av_free(block);
+  }
+}
+
+bool FrameArena::layout(AVCodecContext* ctx) {
+  int w = width_, h = height_;
+  int linesize_align[AV_NUM_DATA_POINTERS];
+  avcodec_align_dimensions2(ctx, &w, &h, linesize_align);
+  if (av_image_fill_linesizes(linesize_, format_, w) < 0) {
+    return false;
+  }
+  ptrdiff_t linesizes[4];
+  for (int i = 0; i < 4; i++) {
+    linesize_[i] = alignUp(linesize_[i]);
+    linesizes[i] = linesize_[i];
+  }
+  size_t sizes[4];
+  if (av_image_fill_plane_sizes(sizes, format_, h, linesizes) < 0) {
+    return false;
+  }
+  size_t offset = 0;
+  for (int i = 0; i < 4; i++) {
+    if (sizes[i] == 0) {
+      plane_offset_[i] = -1;
+      continue;
+    }
+    plane_offset_[i] = offset;
+    // slack after every plane, decoders may read a little past the end
+    offset += alignUp(sizes[i] + kAlign);
+  }
+  aligned_width_ = w;
+  aligned_height_ = h;
+  block_size_ = offset + AV_INPUT_BUFFER_PADDING_SIZE;
+  return true;
+}
+
+// called with mtx_ held
+uint8_t* FrameArena::takeBlock() {
+  if (!free_.empty()) {
+    uint8_t* block = free_.back();
+    free_.pop_back();
+    reuses_++;
+    return block;
+  }
+  auto block = static_cast<uint8_t*>(av_malloc(block_size_));
+  if (block) {
+    blocks_.push_back(block);
+  }
+  return block;
+}
+
+int FrameArena::fill(AVFrame* frame) {
+  uint8_t* block;
+  {
+    std::scoped_lock lk{mtx_};
+    block = takeBlock();
+  }
+  if (!block) {
+    return AVERROR(ENOMEM);
+  }
+  refs_++;
+  frame->buf[0] = av_buffer_create(block, block_size_, &FrameArena::freeBuffer,
+                                   this, 0);
+  if (!frame->buf[0]) {
+    freeBuffer(this, block);
+    return AVERROR(ENOMEM);
+  }
+  for (int i = 0; i < 4; i++) {
+    frame->data[i] = plane_offset_[i] >= 0 ? block + plane_offset_[i] : nullptr;
+    frame->linesize[i] = plane_offset_[i] >= 0 ? linesize_[i] : 0;
+  }
+  frame->extended_data = frame->data;
+  return 0;
+}
+
+void FrameArena::freeBuffer(void* opaque, uint8_t* data) {
+  auto arena = static_cast<FrameArena*>(opaque);
+  {
+    std::scoped_lock lk{arena->mtx_};
+    arena->free_.push_back(data);
+  }
+  arena->unref();
+}
+
+void FrameArena::unref() {
+  if (--refs_ == 0) {
+    delete this;
+  }
+}
+
+int FrameArena::getBuffer2(AVCodecContext* ctx, AVFrame* frame, int flags) {
+  auto arena = static_cast<FrameArena*>(ctx->opaque);
+  if (!arena || frame->format != arena->format_) {
+    return avcodec_default_get_buffer2(ctx, frame, flags);
+  }
+  // frames are requested at the coded size, which may be a little larger
+  // than what the arena was created for
+  int w = frame->width, h = frame->height;
+  int linesize_align[AV_NUM_DATA_POINTERS];
+  avcodec_align_dimensions2(ctx, &w, &h, linesize_align);
+  if (w > arena->aligned_width_ || h > arena->aligned_height_) {
+    return avcodec_default_get_buffer2(ctx, frame, flags);
+  }
+  return arena->fill(frame);
+}
+}  // namespace ArcVP
@@ -0,0 +1,248 @@
+//
+// Created by delta on 5/12/2025.
+//
+
+#include "index_cache.h"
+
+#include <spdlog/spdlog.h>
+
+#include <cstring>
+#include <fstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace ArcVP {
+namespace fs = std::filesystem;
+namespace {
+
+// read-only mapping of a whole file
+class MappedFile {
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+#ifdef _WIN32
+  HANDLE file_ = INVALID_HANDLE_VALUE;
+  HANDLE mapping_ = nullptr;
+#endif
+
+ public:
+  explicit MappedFile(const fs::path& path) {
+#ifdef _WIN32
+    file_ = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file_ == INVALID_HANDLE_VALUE) {
+      return;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file_, &size) || size.QuadPart == 0) {
+      return;
+    }
+    mapping_ = CreateFileMappingW(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping_) {
+      return;
+    }
+    data_ = static_cast<const uint8_t*>(
+        MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+    if (data_) {
+      size_ = size.QuadPart;
+    }
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return;
+    }
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (size > 0) {
+      void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (addr != MAP_FAILED) {
+        data_ = static_cast<const uint8_t*>(addr);
+        size_ = size;
+      }
+    }
+    ::close(fd);
+#endif
+  }
+
+  ~MappedFile() {
+#ifdef _WIN32
+    if (data_) UnmapViewOfFile(data_);
+    if (mapping_) CloseHandle(mapping_);
+    if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+#else
+    if (data_) munmap(const_cast<uint8_t*>(data_), size_);
+#endif
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+};
+
+// FNV-1a
+uint64_t hashPath(const std::string& path) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (unsigned char c : path) {
+    hash ^= c;
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+std::string absolutePath(const std::string& filename) {
+  std::error_code ec;
+  auto path = fs::absolute(filename, ec);
+  return ec ? filename : path.lexically_normal().string();
+}
+
+bool fileStamp(const std::string& filename, uint64_t& size, int64_t& mtime) {
+  std::error_code ec;
+  size = fs::file_size(filename, ec);
+  if (ec) {
+    return false;
+  }
+  mtime = fs::last_write_time(filename, ec).time_since_epoch().count();
+  return !ec;
+}
+
+uint64_t align8(uint64_t n) { return (n + 7) & ~uint64_t{7}; }
+
+// whether `cache` is the cache of `filename` as it is now, with its header
+// copied to `header`
+bool readHeader(const MappedFile& cache, const std::string& filename,
+                IndexCacheHeader& header) {
+  uint64_t file_size;
+  int64_t mtime;
+  if (!fileStamp(filename, file_size, mtime)) {
+    return false;
+  }
+  const uint8_t* base = cache.data();
+  if (!base || cache.size() < sizeof(IndexCacheHeader)) {
+    return false;
+  }
+  std::memcpy(&header, base, sizeof(header));
+  std::string path = absolutePath(filename);
+  uint64_t streams_end =
+      sizeof(header) + uint64_t{header.nb_streams} * sizeof(IndexCacheStream);
+  if (std::memcmp(header.magic, kIndexCacheMagic, sizeof(header.magic)) != 0 ||
+      header.version != kIndexCacheVersion ||
+      header.file_size != file_size || header.mtime != mtime ||
+      streams_end > header.path_offset ||
+      header.path_size != path.size() ||
+      header.path_offset + header.path_size > header.entries_offset ||
+      header.entries_offset > cache.size() ||
+      std::memcmp(base + header.path_offset, path.data(), path.size()) != 0) {
+    spdlog::debug("Stale or foreign index cache for '{}'", filename);
+    return false;
+  }
+  return true;
+}
+}  // namespace
+
+fs::path indexCachePath(const std::string& filename) {
+  std::error_code ec;
+  fs::path dir = fs::temp_directory_path(ec);
+  if (ec) {
+    dir = ".";
+  }
+  return dir / "arcvp-index" /
+         fmt::format("{:016x}.idx", hashPath(absolutePath(filename)));
+}
+
+bool hasIndexCache(const std::string& filename) {
+  MappedFile cache(indexCachePath(filename));
+  IndexCacheHeader header;
+  return readHeader(cache, filename, header);
+}
+
+bool loadIndexCache(const std::string& filename, KeyframeIndex& index) {
+  MappedFile cache(indexCachePath(filename));
+  IndexCacheHeader header;
+  if (!readHeader(cache, filename, header) ||
+      header.nb_streams != uint32_t(index.streamCount())) {
+    return false;
+  }
+  const uint8_t* base = cache.data();
+  uint64_t total_entries =
+      (cache.size() - header.entries_offset) / sizeof(KeyframeEntry);
+  const auto* streams =
+      reinterpret_cast<const IndexCacheStream*>(base + sizeof(header));
+  for (uint32_t i = 0; i < header.nb_streams; i++) {
+    if (streams[i].first_entry + streams[i].entry_count > total_entries) {
+      return false;
+    }
+  }
+  const auto* entries =
+      reinterpret_cast<const KeyframeEntry*>(base + header.entries_offset);
+  for (uint32_t i = 0; i < header.nb_streams; i++) {
+    index.assign(i, entries + streams[i].first_entry, streams[i].entry_count);
+  }
+  index.markComplete();
+  return true;
+}
+
+bool saveIndexCache(const std::string& filename, KeyframeIndex& index) {
+  IndexCacheHeader header{};
+  std::memcpy(header.magic, kIndexCacheMagic, sizeof(header.magic));
+  header.version = kIndexCacheVersion;
+  if (!fileStamp(filename, header.file_size, header.mtime)) {
+    return false;
+  }
+  std::string path = absolutePath(filename);
+  header.nb_streams = index.streamCount();
+  header.path_size = path.size();
+  header.path_offset =
+      sizeof(header) + uint64_t{header.nb_streams} * sizeof(IndexCacheStream);
+  header.entries_offset = align8(header.path_offset + header.path_size);
+
+  std::vector<IndexCacheStream> streams(header.nb_streams);
+  std::vector<KeyframeEntry> entries;
+  for (uint32_t i = 0; i < header.nb_streams; i++) {
+    auto stream_entries = index.entries(i);
+    streams[i] = {entries.size(), stream_entries.size()};
+    entries.insert(entries.end(), stream_entries.begin(), stream_entries.end());
+  }
+
+  fs::path cache_path = indexCachePath(filename);
+  std::error_code ec;
+  fs::create_directories(cache_path.parent_path(), ec);
+  // write next to the cache and rename, a reader never maps a partial file
+  fs::path tmp_path = cache_path;
+  tmp_path += ".tmp";
+  {
+    std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+      spdlog::warn("Unable to write index cache '{}'", tmp_path.string());
+      return false;
+    }
+    static constexpr char padding[8] = {};
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(streams.data()),
+              streams.size() * sizeof(IndexCacheStream));
+    out.write(path.data(), path.size());
+    out.write(padding, header.entries_offset - header.path_offset -
+                           header.path_size);
+    out.write(reinterpret_cast<const char*>(entries.data()),
+              entries.size() * sizeof(KeyframeEntry));
+    if (!out) {
+      spdlog::warn("Unable to write index cache '{}'", tmp_path.string());
+      return false;
+    }
+  }
+  fs::rename(tmp_path, cache_path, ec);
+  if (ec) {
+    spdlog::warn("Unable to store index cache '{}': {}", cache_path.string(),
+                 ec.message());
+    fs::remove(tmp_path, ec);
+    return false;
+  }
+  spdlog::info("Saved keyframe index to '{}'", cache_path.string());
+  return true;
+}
+}  // namespace ArcVP
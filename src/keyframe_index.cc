@@ -0,0 +1,67 @@
+//
+// Created by delta on 5/11/2025.
+//
+
+#include "player.h"
+
+#include "index_cache.h"
+
+namespace ArcVP {
+void Player::indexThreadWorker(std::string filename) {
+  // a format context of our own, so the pass never moves the playback demuxer
+  AVFormatContext* formatContext = nullptr;
+  int ret =
+      avformat_open_input(&formatContext, filename.c_str(), nullptr, nullptr);
+  if (ret != 0) {
+    spdlog::error("Index: unable to open file '{}': {}", filename,
+                  av_err2str(ret));
+    return;
+  }
+  // seeks go through the video stream whenever there is one. Without it they
+  // go through the audio track playing, which may be any of them by then.
+  // Every audio packet is a keyframe, so audio is only indexed if needed.
+  bool index_audio = media_.video_stream_index_ < 0;
+  for (unsigned i = 0; i < formatContext->nb_streams; i++) {
+    bool audio =
+        formatContext->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO;
+    if (int(i) != media_.video_stream_index_ && !(audio && index_audio)) {
+      formatContext->streams[i]->discard = AVDISCARD_ALL;
+    }
+  }
+
+  AVPacket* pkt = av_packet_alloc();
+  if (!pkt) {
+    spdlog::error("Fail to allocate AVPacket");
+    std::exit(1);
+  }
+  std::vector<int64_t> packet_count(formatContext->nb_streams, 0);
+  auto start = steady_clock::now();
+  while (!sync_state_.should_exit && !index_cancel_) {
+    ret = av_read_frame(formatContext, pkt);
+    if (ret < 0) {
+      if (ret != AVERROR_EOF) {
+        spdlog::error("Index: error reading frame: {}", av_err2str(ret));
+      }
+      break;
+    }
+    int64_t packet_index = packet_count[pkt->stream_index]++;
+    if (pkt->flags & AV_PKT_FLAG_KEY) {
+      int64_t pts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+      keyframe_index_.add(pkt->stream_index, {pts, pkt->pos, packet_index});
+    }
+    av_packet_unref(pkt);
+  }
+  if (ret == AVERROR_EOF) {
+    keyframe_index_.markComplete();
+    spdlog::info(
+        "Keyframe index built in {}ms, video keyframes: {}, audio keyframes: "
+        "{}",
+        duration_cast<milliseconds>(steady_clock::now() - start).count(),
+        keyframe_index_.size(media_.video_stream_index_),
+        keyframe_index_.size(media_.audio_stream_index_));
+    saveIndexCache(filename, keyframe_index_);
+  }
+  av_packet_free(&pkt);
+  avformat_close_input(&formatContext);
+}
+}  // namespace ArcVP
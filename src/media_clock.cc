@@ -0,0 +1,99 @@
+//
+// Created by delta on 5/21/2025.
+//
+
+#include "media_clock.h"
+
+#include <algorithm>
+
+#include "timebase.h"
+
+namespace ArcVP {
+
+int64_t MediaClock::timeLocked(int64_t now_us) const {
+  if (paused_) {
+    return base_us_;
+  }
+  int64_t elapsed_us = (now_us - anchor_us_) * speed_;
+  if (master_ == Master::Audio && reported_) {
+    elapsed_us = std::min(elapsed_us, max_extrapolate_us_);
+  }
+  return base_us_ + elapsed_us;
+}
+
+void MediaClock::reset(Master master, int64_t max_extrapolate_us) {
+  std::scoped_lock lk{mtx_};
+  master_ = master;
+  max_extrapolate_us_ = max_extrapolate_us;
+  reported_ = false;
+  base_us_ = 0;
+  anchor_us_ = nowUs();
+}
+
+void MediaClock::set(int64_t media_us) {
+  std::scoped_lock lk{mtx_};
+  base_us_ = media_us;
+  anchor_us_ = nowUs();
+  reported_ = false;
+}
+
+void MediaClock::pause() {
+  std::scoped_lock lk{mtx_};
+  int64_t now_us = nowUs();
+  base_us_ = timeLocked(now_us);
+  anchor_us_ = now_us;
+  paused_ = true;
+}
+
+void MediaClock::resume() {
+  std::scoped_lock lk{mtx_};
+  anchor_us_ = nowUs();
+  paused_ = false;
+}
+
+void MediaClock::setSpeed(double speed) {
+  std::scoped_lock lk{mtx_};
+  int64_t now_us = nowUs();
+  base_us_ = timeLocked(now_us);
+  anchor_us_ = now_us;
+  speed_ = speed;
+}
+
+void MediaClock::reportAudio(int64_t media_us) {
+  std::scoped_lock lk{mtx_};
+  if (master_ != Master::Audio || paused_) {
+    return;
+  }
+  base_us_ = media_us;
+  anchor_us_ = nowUs();
+  reported_ = true;
+}
+
+void MediaClock::useSteady() {
+  std::scoped_lock lk{mtx_};
+  if (master_ == Master::Steady) {
+    return;
+  }
+  int64_t now_us = nowUs();
+  base_us_ = timeLocked(now_us);
+  anchor_us_ = now_us;
+  master_ = Master::Steady;
+}
+
+void MediaClock::useAudio() {
+  std::scoped_lock lk{mtx_};
+  if (master_ == Master::Audio) {
+    return;
+  }
+  int64_t now_us = nowUs();
+  base_us_ = timeLocked(now_us);
+  anchor_us_ = now_us;
+  master_ = Master::Audio;
+  reported_ = false;
+}
+
+int64_t MediaClock::timeUs() const {
+  std::scoped_lock lk{mtx_};
+  return timeLocked(nowUs());
+}
+}  // namespace ArcVP
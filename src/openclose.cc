@@ -4,6 +4,8 @@
 
 #include "player.h"
 
+#include "index_cache.h"
+
 namespace ArcVP {
 std::tuple<int, int> findAVStream(AVFormatContext *formatContext) {
   int videoStreamIndex = -1, audioStreamIndex = -1;
@@ -13,47 +15,287 @@ std::tuple<int, int> findAVStream(AVFormatContext *formatContext) {
                                          -1, nullptr, 0);
   return std::make_tuple(videoStreamIndex, audioStreamIndex);
 }
-void Player::demuxAllPackets() {
-  while (true) {
-    AVPacket *pkt = av_packet_alloc();
-    if (!pkt) {
-      spdlog::error("Fail to allocate AVPacket");
-      std::exit(1);
+// frame and/or slice threading, whatever the config allows and the decoder
+// supports, with one thread per core by default
+void setupDecodeThreads(AVCodecContext *codecContext, const AVCodec *codec,
+                        const DecodeThreadConfig &config) {
+  int threadType = 0;
+  if (config.frame_threads &&
+      codec->capabilities & AV_CODEC_CAP_FRAME_THREADS) {
+    threadType |= FF_THREAD_FRAME;
+  }
+  if (config.slice_threads &&
+      codec->capabilities & AV_CODEC_CAP_SLICE_THREADS) {
+    threadType |= FF_THREAD_SLICE;
+  }
+  int threadCount = config.thread_count;
+  if (threadCount <= 0) {
+    threadCount = std::clamp<int>(std::thread::hardware_concurrency(), 1,
+                                  config.max_threads);
+  }
+  codecContext->thread_type = threadType;
+  codecContext->thread_count = threadType ? threadCount : 1;
+}
+
+const char *threadTypeName(int threadType) {
+  switch (threadType) {
+    case FF_THREAD_FRAME:
+      return "frame";
+    case FF_THREAD_SLICE:
+      return "slice";
+    case FF_THREAD_FRAME | FF_THREAD_SLICE:
+      return "frame+slice";
+    default:
+      return "none";
+  }
+}
+
+const char *openStateName(OpenState state) {
+  switch (state) {
+    case OpenState::Idle:
+      return "idle";
+    case OpenState::Probing:
+      return "probing";
+    case OpenState::CodecsReady:
+      return "codecs ready";
+    case OpenState::FirstFrameReady:
+      return "first frame ready";
+    case OpenState::Failed:
+      return "failed";
+  }
+  return "unknown";
+}
+
+namespace {
+// whether find_stream_info got far enough for us to set up the decoders
+bool streamsIdentified(AVFormatContext *formatContext) {
+  auto [videoStreamIndex, audioStreamIndex] = findAVStream(formatContext);
+  if (videoStreamIndex >= 0) {
+    const AVCodecParameters *params =
+        formatContext->streams[videoStreamIndex]->codecpar;
+    if (params->width <= 0 || params->height <= 0 || params->format < 0) {
+      return false;
+    }
+  }
+  if (audioStreamIndex >= 0) {
+    const AVCodecParameters *params =
+        formatContext->streams[audioStreamIndex]->codecpar;
+    if (params->sample_rate <= 0 || params->ch_layout.nb_channels <= 0 ||
+        params->format < 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+AudioTrack describeAudioTrack(const AVStream *stream) {
+  AudioTrack track;
+  track.stream_index = stream->index;
+  if (auto entry = av_dict_get(stream->metadata, "language", nullptr, 0)) {
+    track.language = entry->value;
+  }
+  if (auto entry = av_dict_get(stream->metadata, "title", nullptr, 0)) {
+    track.title = entry->value;
+  }
+  track.codec = avcodec_get_name(stream->codecpar->codec_id);
+  track.channels = stream->codecpar->ch_layout.nb_channels;
+  track.sample_rate = stream->codecpar->sample_rate;
+  return track;
+}
+}  // namespace
+
+// lets a blocking read inside FFmpeg give up when we exit
+int Player::interruptCallback(void *opaque) {
+  return static_cast<Player *>(opaque)->sync_state_.should_exit ? 1 : 0;
+}
+
+// Opens the input and identifies its streams within the probe budget. A file
+// that needs more is probed once more with a larger budget, instead of
+// everyone paying FFmpeg's 5MB/5s default up front. A file we hold a keyframe
+// index for was played before and starts from the much smaller cached budget.
+AVFormatContext *Player::probeInput(const std::string &filename) {
+  bool cached = hasIndexCache(filename);
+  bool retried = false;
+  int64_t probesize =
+      cached ? probe_config_.cached_probesize : probe_config_.probesize;
+  int64_t analyzeduration = cached ? probe_config_.cached_analyzeduration_us
+                                   : probe_config_.analyzeduration_us;
+  open_timings_.cached_probe = cached;
+  for (int attempt = 1;; attempt++) {
+    AVFormatContext *formatContext = avformat_alloc_context();
+    if (!formatContext) {
+      spdlog::error("Unable to allocate format context");
+      return nullptr;
     }
-    int ret;
-      ret = av_read_frame(media_.format_context_, pkt);
+    formatContext->interrupt_callback = {&Player::interruptCallback, this};
+    AVDictionary *options = nullptr;
+    av_dict_set_int(&options, "probesize", probesize, 0);
+    av_dict_set_int(&options, "analyzeduration", analyzeduration, 0);
+    int ret = avformat_open_input(&formatContext, filename.c_str(), nullptr,
+                                  &options);
+    av_dict_free(&options);
+    if (ret != 0) {
+      spdlog::error("Unable to open file '{}': {}", filename, av_err2str(ret));
+      return nullptr;
+    }
+    open_timings_.probe_attempts = attempt;
+    ret = avformat_find_stream_info(formatContext, nullptr);
     if (ret < 0) {
-      av_packet_free(&pkt);
-      if (ret == AVERROR_EOF) {
-        spdlog::info("Packet decode worker quited due to EOF");
-        break;
-      }
-      spdlog::error("Error reading frame: {}", av_err2str(ret));
-      std::exit(1);
+      spdlog::error("Unable to find stream info: {}", av_err2str(ret));
+      avformat_close_input(&formatContext);
+      return nullptr;
+    }
+    bool last = !cached && (retried || probe_config_.retry_factor <= 1);
+    if (streamsIdentified(formatContext) || last) {
+      return formatContext;
     }
-    if (pkt->stream_index == media_.video_stream_index_) {
-      video_decode_worker_.packet_chan.push_back(pkt);
-    } else if (pkt->stream_index == media_.audio_stream_index_) {
-      audio_decode_worker_.packet_chan.push_back(pkt);
-    } else {
-      spdlog::warn("Unknown packet index: {}", pkt->stream_index);
-      av_packet_free(&pkt);
+    avformat_close_input(&formatContext);
+    if (cached) {
+      spdlog::info("Streams not identified within the cached probe budget");
+      cached = false;
+      probesize = probe_config_.probesize;
+      analyzeduration = probe_config_.analyzeduration_us;
+      continue;
     }
+    spdlog::info(
+        "Streams not identified within {} KB / {} ms, probing {}x further",
+        probesize / 1024, analyzeduration / 1000, probe_config_.retry_factor);
+    retried = true;
+    probesize *= probe_config_.retry_factor;
+    analyzeduration *= probe_config_.retry_factor;
+  }
+}
+
+AVCodecContext *Player::openVideoCodec(const AVCodec *codec,
+                                       const AVCodecParameters *params) {
+  AVCodecContext *codecContext = avcodec_alloc_context3(codec);
+  if (!codecContext) {
+    spdlog::error("Unable to allocate video codec context");
+    std::exit(1);
+  }
+  int ret = avcodec_parameters_to_context(codecContext, params);
+  if (ret < 0) {
+    spdlog::error("Unable to initialize video codec context: {}",
+                  av_err2str(ret));
+    avcodec_free_context(&codecContext);
+    return nullptr;
+  }
+  // decode into the picture arena, reused when reopening at the same size
+  if (frame_arena_ &&
+      !frame_arena_->matches(codecContext->width, codecContext->height,
+                             codecContext->pix_fmt)) {
+    frame_arena_->retire();
+    frame_arena_ = nullptr;
+  }
+  if (!frame_arena_) {
+    frame_arena_ = FrameArena::create(codecContext);
+  }
+  if (frame_arena_) {
+    frame_arena_->attach(codecContext);
+  }
+  setupDecodeThreads(codecContext, codec, decode_thread_config_);
+  if (ret = avcodec_open2(codecContext, codec, nullptr), ret < 0) {
+    spdlog::error("Unable to open video codec: {}", av_err2str(ret));
+    avcodec_free_context(&codecContext);
+    return nullptr;
+  }
+  spdlog::info("Video decoder '{}': {} threads, {} threading", codec->name,
+               codecContext->thread_count,
+               threadTypeName(codecContext->active_thread_type));
+  return codecContext;
+}
+
+AVCodecContext *Player::openAudioCodec(const AVCodec *codec,
+                                       const AVCodecParameters *params) {
+  AVCodecContext *codecContext = avcodec_alloc_context3(codec);
+  if (!codecContext) {
+    spdlog::error("Unable to allocate audio codec context");
+    std::exit(1);
+  }
+  int ret = avcodec_parameters_to_context(codecContext, params);
+  if (ret < 0) {
+    spdlog::error("Unable to initialize audio codec context: {}",
+                  av_err2str(ret));
+    avcodec_free_context(&codecContext);
+    return nullptr;
+  }
+  if (ret = avcodec_open2(codecContext, codec, nullptr), ret < 0) {
+    spdlog::error("Unable to open audio codec: {}", av_err2str(ret));
+    avcodec_free_context(&codecContext);
+    return nullptr;
+  }
+  return codecContext;
+}
+
+void Player::joinOpenThread() {
+  if (open_thread_ && open_thread_->joinable()) {
+    open_thread_->join();
   }
+  open_thread_ = nullptr;
+}
+
+void Player::stopIndexThread() {
+  if (index_thread_ && index_thread_->joinable()) {
+    index_cancel_ = true;
+    index_thread_->join();
+  }
+  index_thread_ = nullptr;
+  index_cancel_ = false;
+}
+
+void Player::openAsync(const std::string &filename) {
+  // the thread of the previous open is done by now, it only sets up media_
+  joinOpenThread();
+  open_started_us_ = nowUs();
+  open_timings_.reset();
+  setOpenState(OpenState::Probing);
+  open_thread_ = std::make_unique<std::thread>([this, filename] {
+    bool ok = openMedia(filename);
+    if (ok) {
+      open_timings_.codecs_ready_us = nowUs() - open_started_us_;
+    }
+    setOpenState(ok ? OpenState::CodecsReady : OpenState::Failed);
+  });
 }
+
 bool Player::open(const char *filename) {
+  openAsync(filename);
+  return waitOpenState(OpenState::CodecsReady) != OpenState::Failed;
+}
+
+void Player::setOpenState(OpenState state) {
+  {
+    std::scoped_lock lk{open_mtx_};
+    open_state_ = state;
+  }
+  open_cv_.notify_all();
+}
+
+OpenState Player::waitOpenState(OpenState state) {
+  std::unique_lock lk{open_mtx_};
+  // Failed sorts last, so it ends every wait
+  open_cv_.wait(lk, [&] { return open_state_ >= state; });
+  return open_state_;
+}
+
+// called by the worker of the presented stream with every frame it outputs
+void Player::firstFrameReady() {
+  if (open_state_ != OpenState::CodecsReady) {
+    return;
+  }
+  open_timings_.first_frame_us = nowUs() - open_started_us_;
+  spdlog::info("First frame after {} ms", open_timings_.first_frame_us / 1000);
+  setOpenState(OpenState::FirstFrameReady);
+  if (play_on_first_frame_.exchange(false)) {
+    unpause();
+  }
+}
+
+bool Player::openMedia(const std::string &filename) {
   std::scoped_lock lk{media_.format_mtx_, media_.video_codec_mtx_,
                       media_.audio_codec_mtx_};
-  // open file and find stream info
-  AVFormatContext *formatContext = nullptr;
-  int ret = avformat_open_input(&formatContext, filename, nullptr, nullptr);
-  if (ret != 0) {
-    spdlog::error("Unable to open file '{}': {}", filename, av_err2str(ret));
-    return false;
-  }
-  ret = avformat_find_stream_info(formatContext, nullptr);
-  if (ret != 0) {
-    spdlog::error("Unable to find stream info: {}", av_err2str(ret));
+  AVFormatContext *formatContext = probeInput(filename);
+  if (!formatContext) {
     return false;
   }
 
@@ -61,14 +303,16 @@ bool Player::open(const char *filename) {
   auto [videoStreamIndex, audioStreamIndex] = findAVStream(formatContext);
   bool hasVideo = true, hasAudio = true;
 
-  if (videoStreamIndex == -1) {
+  if (videoStreamIndex < 0) {
     spdlog::info("Unable to find video stream");
     hasVideo = false;
+    videoStreamIndex = -1;
   }
 
-  if (audioStreamIndex == -1) {
+  if (audioStreamIndex < 0) {
     spdlog::info("Unable to find audio stream");
     hasAudio = false;
+    audioStreamIndex = -1;
   }
 
   // setup video codec
@@ -83,6 +327,7 @@ bool Player::open(const char *filename) {
     videoCodec = avcodec_find_decoder(videoCodecParams->codec_id);
     if (videoCodec == nullptr) {
       spdlog::error("Unable to find video codec");
+      avformat_close_input(&formatContext);
       return false;
     }
   }
@@ -93,50 +338,48 @@ bool Player::open(const char *filename) {
     audioCodecParams = audioStream->codecpar;
     audioCodec = avcodec_find_decoder(audioCodecParams->codec_id);
     if (audioCodec == nullptr) {
-      spdlog::error("Unable to find video codec");
+      spdlog::error("Unable to find audio codec");
+      avformat_close_input(&formatContext);
       return false;
     }
   }
 
-  // setup codec context
+  // the codecs are independent and opening one can take a while (thread
+  // pools, hardware probing), so they open side by side
   AVCodecContext *videoCodecContext = nullptr, *audioCodecContext = nullptr;
+  std::thread audioOpener;
+  if (hasAudio) {
+    audioOpener = std::thread([&] {
+      audioCodecContext = openAudioCodec(audioCodec, audioCodecParams);
+    });
+  }
+  if (hasVideo) {
+    videoCodecContext = openVideoCodec(videoCodec, videoCodecParams);
+  }
+  if (audioOpener.joinable()) {
+    audioOpener.join();
+  }
+  if ((hasVideo && !videoCodecContext) || (hasAudio && !audioCodecContext)) {
+    avcodec_free_context(&videoCodecContext);
+    avcodec_free_context(&audioCodecContext);
+    avformat_close_input(&formatContext);
+    return false;
+  }
   if (hasVideo) {
-    videoCodecContext = avcodec_alloc_context3(videoCodec);
-    if (!videoCodecContext) {
-      spdlog::error("Unable to allocate video codec context");
-      std::exit(1);
-    }
-    if (ret =
-            avcodec_parameters_to_context(videoCodecContext, videoCodecParams),
-        ret < 0) {
-      spdlog::error("Unable to initialize video codec context: {}",
-                    av_err2str(ret));
-      return false;
-    }
-    if (ret = avcodec_open2(videoCodecContext, videoCodec, nullptr), ret < 0) {
-      spdlog::error("Unable to open video codec: {}", av_err2str(ret));
-      return false;
-    }
     this->width = videoCodecParams->width;
     this->height = videoCodecParams->height;
   }
 
-  if (hasAudio) {
-    audioCodecContext = avcodec_alloc_context3(audioCodec);
-    if (!audioCodecContext) {
-      spdlog::error("Unable to allocate audio codec context");
-      std::exit(1);
+  // streams we do not play are skipped inside av_read_frame instead of being
+  // read, allocated and thrown away. The other audio tracks stay selectable.
+  std::vector<AudioTrack> audioTracks;
+  for (unsigned i = 0; i < formatContext->nb_streams; i++) {
+    AVStream *stream = formatContext->streams[i];
+    if (stream->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
+      audioTracks.push_back(describeAudioTrack(stream));
     }
-    if (ret =
-            avcodec_parameters_to_context(audioCodecContext, audioCodecParams),
-        ret < 0) {
-      spdlog::error("Unable to initialize audio codec context: {}",
-                    av_err2str(ret));
-      return false;
-    }
-    if (ret = avcodec_open2(audioCodecContext, audioCodec, nullptr), ret < 0) {
-      spdlog::error("Unable to open audio codec: {}", av_err2str(ret));
-      return false;
+    if (int(i) != videoStreamIndex && int(i) != audioStreamIndex) {
+      stream->discard = AVDISCARD_ALL;
     }
   }
 
@@ -153,26 +396,96 @@ bool Player::open(const char *filename) {
   this->media_.audio_codec_ = audioCodec;
   this->media_.audio_codec_params_ = audioCodecParams;
   this->media_.audio_codec_context_ = audioCodecContext;
+  this->media_.audio_tracks_ = std::move(audioTracks);
+  this->audio_track_ = audioStreamIndex;
+  if (hasVideo) {
+    video_decode_worker_.packet_chan.setTimeBase(videoStream->time_base);
+    AVRational frameRate = av_guess_frame_rate(
+        formatContext, formatContext->streams[videoStreamIndex], nullptr);
+    // what the queue holds is in the converted format
+    AVPixelFormat outputFormat =
+        PixelConverter::outputFormat(videoCodecContext->pix_fmt);
+    pixel_converter_.setOutput(outputFormat);
+    spdlog::info("Video output: {} to {}, {} ({} kernels)",
+                 av_get_pix_fmt_name(videoCodecContext->pix_fmt),
+                 av_get_pix_fmt_name(outputFormat),
+                 pixel_converter_.pathName(videoCodecContext->pix_fmt),
+                 PixelConverter::kernelName());
+    int64_t frameBytes = av_image_get_buffer_size(outputFormat, this->width,
+                                                  this->height, 1);
+    int64_t depth = video_decode_worker_.output_queue.configure(
+        frameBytes, frameRate.num > 0 ? av_q2d(frameRate) : 0,
+        queue_budget_.video_max_bytes, queue_budget_);
+    spdlog::info("Video frame queue: {} frames of {} KB", depth,
+                 frameBytes / 1024);
+  }
+  if (hasAudio) {
+    audio_rate_ = audioCodecContext->sample_rate;
+    av_channel_layout_uninit(&audio_layout_);
+    av_channel_layout_copy(&audio_layout_, &audioCodecContext->ch_layout);
+    resampler_.setOutput(audio_rate_, audio_layout_);
+    audio_decode_worker_.packet_chan.setTimeBase(audioStream->time_base);
+  }
 
-  spdlog::info("Opened file '{}'", filename);
-  demuxAllPackets();
+  spdlog::info("Opened file '{}' after {} probes, {} audio tracks", filename,
+               open_timings_.probe_attempts.load(),
+               media_.audio_tracks_.size());
+  demux_worker_.spawn([this] { this->demuxThreadWorker(); });
+  keyframe_index_.reset(formatContext->nb_streams);
+  if (loadIndexCache(filename, keyframe_index_)) {
+    spdlog::info("Loaded keyframe index from '{}'",
+                 indexCachePath(filename).string());
+  } else {
+    index_thread_ = std::make_unique<std::thread>(
+        [this, path = filename] { indexThreadWorker(path); });
+  }
   return true;
 }
 
-void Player::close() {
-  std::scoped_lock lk{sync_state_.mtx_};
-  pause();
-  sync_state_.sample_count_ = 0;
+// Ends the demux and decode threads of the open file and empties what they
+// left in the queues, so the next open starts them over on fresh rings.
+void Player::stopWorkers() {
+  {
+    std::scoped_lock demux_lock{demux_worker_.mtx};
+    demux_worker_.status = WorkerStatus::Exiting;
+  }
+  demux_worker_.cv.notify_all();
+  // wakes every thread blocked on a ring, their loops end on the failed
+  // push or pop
+  for (auto worker : {&video_decode_worker_, &audio_decode_worker_}) {
+    worker->packet_chan.abort();
+    worker->output_queue.close();
+  }
+  pcm_ring_.close();
+  demux_worker_.join();
+  video_decode_worker_.join();
+  audio_decode_worker_.join();
 
-  audio_decode_worker_.status = WorkerStatus::Idle;
-  video_decode_worker_.status = WorkerStatus::Idle;
+  for (auto worker : {&video_decode_worker_, &audio_decode_worker_}) {
+    worker->packet_chan.reset();
+    worker->output_queue.reset(frame_pool_);
+  }
+  pcm_ring_.reset(pcm_ring_.capacity());
+}
 
-  // video_frame_queue_.clear();
-  // audio_frame_queue_.clear();
-  // // waits for the worker to put packet into the channel
-  // video_packet_channel_.clear();
-  // audio_packet_channel_.clear();
+void Player::close() {
+  // an open still in flight would fill media_ after we cleared it
+  joinOpenThread();
+  stopIndexThread();
+  play_on_first_frame_ = false;
+  pause();
+  if (audio_stream) {
+    // unbinds it, the device callback does not run after this
+    SDL_DestroyAudioStream(audio_stream);
+    audio_stream = nullptr;
+  }
+  callback_media_carry_ = 0;
+  drain_until_us_ = 0;
+  // the decoders must be out of their codecs before those are freed
+  stopWorkers();
 
+  std::scoped_lock lk{sync_state_.mtx_};
+  sync_state_.sample_count_ = 0;
   {
     std::scoped_lock media_lock{media_.format_mtx_, media_.video_codec_mtx_,
                                 media_.audio_codec_mtx_};
@@ -198,8 +511,15 @@ void Player::close() {
       avcodec_free_context(&media_.audio_codec_context_);
     }
     this->media_.audio_codec_context_ = nullptr;
+    this->media_.audio_tracks_.clear();
+    this->audio_track_ = -1;
+    std::scoped_lock switch_lock{track_switch_mtx_};
+    avcodec_free_context(&requested_track_.codec_context);
+    avcodec_free_context(&switched_track_.codec_context);
+    requested_track_ = switched_track_ = {};
   }
 
+  setOpenState(OpenState::Idle);
   spdlog::info("Closed Input");
 }
 }  // namespace ArcVP
\ No newline at end of file
@@ -16,52 +16,143 @@ void pushFinishEvent() {
   event.type = ARCVP_EVENT_FINISH;
   SDL_PushEvent(&event);
 }
-//
-// void Player::packetDecodeThreadWorker() {
-//   // demux all packets from the format context
-//   while (true) {
-//     std::unique_lock status_lock{packet_decode_worker_.mtx};
-//     packet_decode_worker_.cv.wait(status_lock, [this] {
-//       return packet_decode_worker_.status != WorkerStatus::Idle;
-//     });
-//     if (packet_decode_worker_.status == WorkerStatus::Exiting) {
-//       break;
-//     }
-//     AVPacket* pkt = av_packet_alloc();
-//     if (!pkt) {
-//       spdlog::error("Fail to allocate AVPacket");
-//       std::exit(1);
-//     }
-//     int ret;
-//     {
-//       std::scoped_lock lk{media_.format_mtx_};
-//       ret = av_read_frame(media_.format_context_, pkt);
-//     }
-//     if (ret < 0) {
-//       av_packet_free(&pkt);
-//       if (ret == AVERROR_EOF) {
-//         packet_decode_worker_.status = WorkerStatus::Idle;
-//         spdlog::info("Packet decode worker idled due to EOF");
-//         continue;
-//       }
-//       spdlog::error("Error reading frame: {}", av_err2str(ret));
-//       std::exit(1);
-//     }
-//     if (pkt->stream_index == media_.video_stream_index_) {
-//       bool ok = video_decode_worker_.packet_chan.send(pkt);
-//       if (!ok) {
-//         packet_decode_worker_.status = WorkerStatus::Exiting;
-//       }
-//     } else if (pkt->stream_index == media_.audio_stream_index_) {
-//       bool ok = audio_decode_worker_.packet_chan.send(pkt);
-//       if (!ok) {
-//         packet_decode_worker_.status = WorkerStatus::Exiting;
-//       }
-//     } else {
-//       spdlog::warn("Unknown packet index: {}", pkt->stream_index);
-//       av_packet_free(&pkt);
-//     }
-//   }
-//   spdlog::info("Packet decode thread exited");
-// }
-}  // namespace ArcVP
\ No newline at end of file
+
+bool Player::readAheadFull() {
+  const auto& limits = demux_worker_.limits;
+  auto& video_chan = video_decode_worker_.packet_chan;
+  auto& audio_chan = audio_decode_worker_.packet_chan;
+  if (video_chan.bytes() + audio_chan.bytes() >= limits.max_total_bytes) {
+    return true;
+  }
+  // keep reading while any stream in use is below its read-ahead, otherwise a
+  // badly interleaved file would starve one decoder
+  bool video_enough = media_.video_stream_index_ < 0 ||
+                      video_chan.hasEnough(limits);
+  // muted while fast-forwarding, nothing gets queued for audio then
+  bool audio_enough = media_.audio_stream_index_ < 0 ||
+                      fastForward() != DegradationLevel::None ||
+                      audio_chan.hasEnough(limits);
+  return video_enough && audio_enough;
+}
+
+// Keyframes-only fast-forward: jump straight to the keyframe due next instead
+// of reading the GOPs in between, so the work per wall second stays at about
+// kFastForwardFps keyframes whatever the speed.
+void Player::skipToDueKeyframe(int64_t pts, int serial) {
+  if (pts == AV_NOPTS_VALUE) {
+    return;
+  }
+  int stream_index = media_.video_stream_index_;
+  int64_t step = std::max<int64_t>(
+      timeToPts(fast_forward_step_ms_, media_.video_stream_->time_base), 1);
+  auto next = keyframe_index_.ceil(stream_index, pts + 1);
+  auto due = keyframe_index_.ceil(stream_index, pts + step);
+  if (!next || !due || due->pts == next->pts) {
+    // the next keyframe is due anyway, or the index does not reach that far
+    // yet and we read on
+    return;
+  }
+  std::scoped_lock lk{media_.format_mtx_};
+  if (serial != demux_worker_.serial) {
+    // a seek got in first
+    return;
+  }
+  int ret = av_seek_frame(media_.format_context_, stream_index, due->pts,
+                          AVSEEK_FLAG_BACKWARD);
+  if (ret < 0) {
+    spdlog::warn("Unable to skip to keyframe {}: {}", due->pts,
+                 av_err2str(ret));
+  }
+}
+
+void Player::demuxThreadWorker() {
+  while (!sync_state_.should_exit) {
+    {
+      std::unique_lock lk{demux_worker_.mtx};
+      // back-pressure: only read once a queue has room, idle after EOF until
+      // a seek restarts us. The decoders wake us after every packet they
+      // take, seekTo and close() after changing the status.
+      demux_worker_.cv.wait(lk, [this] {
+        return sync_state_.should_exit || seek_slot_.pending() ||
+               demux_worker_.status == WorkerStatus::Exiting ||
+               (demux_worker_.status == WorkerStatus::Working &&
+                !readAheadFull());
+      });
+      if (demux_worker_.status == WorkerStatus::Exiting) {
+        break;
+      }
+    }
+    if (sync_state_.should_exit) {
+      break;
+    }
+    if (auto request = seek_slot_.take()) {
+      performSeek(*request);
+    }
+    AVPacket* pkt = packet_pool_.acquire();
+    if (!pkt) {
+      spdlog::error("Fail to allocate AVPacket");
+      std::exit(1);
+    }
+    int ret, serial;
+    {
+      std::scoped_lock lk{media_.format_mtx_};
+      serial = demux_worker_.serial;
+      auto start = steady_clock::now();
+      ret = av_read_frame(media_.format_context_, pkt);
+      stats_.demux.record(elapsedUs(start));
+    }
+    if (ret < 0) {
+      packet_pool_.release(pkt);
+      if (ret == AVERROR_EOF) {
+        if (media_.video_stream_index_ >= 0) {
+          video_decode_worker_.packet_chan.pushEof(serial);
+        }
+        if (media_.audio_stream_index_ >= 0) {
+          audio_decode_worker_.packet_chan.pushEof(serial);
+        }
+        std::scoped_lock lk{demux_worker_.mtx};
+        if (serial == demux_worker_.serial) {
+          demux_worker_.status = WorkerStatus::Idle;
+          spdlog::info("Demux worker idled due to EOF");
+        }
+        continue;
+      }
+      if (ret == AVERROR_EXIT || sync_state_.should_exit) {
+        // the interrupt callback broke off the read because we are quitting
+        break;
+      }
+      spdlog::error("Error reading frame: {}", av_err2str(ret));
+      std::exit(1);
+    }
+    DegradationLevel fast_forward = fastForward();
+    bool queued = false;
+    if (pkt->stream_index == media_.video_stream_index_) {
+      // at keyframes-only speeds the decoder would discard the rest anyway
+      bool keyframes_only = fast_forward == DegradationLevel::KeyframesOnly;
+      int64_t pts = pkt->pts;
+      if (!keyframes_only || pkt->flags & AV_PKT_FLAG_KEY) {
+        queued = video_decode_worker_.packet_chan.push(pkt, serial);
+      }
+      if (queued && keyframes_only) {
+        skipToDueKeyframe(pts, serial);
+      }
+    } else if (pkt->stream_index == media_.audio_stream_index_) {
+      queued = fast_forward == DegradationLevel::None &&
+               audio_decode_worker_.packet_chan.push(pkt, serial);
+    } else {
+      // a stream that showed up after open, or what the demuxer had buffered
+      // of a track switched away from. Not read from here on.
+      std::scoped_lock lk{media_.format_mtx_};
+      AVStream* stream = media_.format_context_->streams[pkt->stream_index];
+      if (stream->discard != AVDISCARD_ALL) {
+        spdlog::debug("Discarding stream {}", pkt->stream_index);
+        stream->discard = AVDISCARD_ALL;
+      }
+    }
+    if (!queued) {
+      packet_pool_.release(pkt);
+    }
+  }
+  spdlog::info("Demux thread exited");
+}
+}  // namespace ArcVP
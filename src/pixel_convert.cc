@@ -0,0 +1,293 @@
+//
+// Created by delta on 5/24/2025.
+//
+
+#include "pixel_convert.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+
+#include "cpu_features.h"
+
+extern "C" {
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+}
+
+namespace ArcVP {
+namespace {
+
+// n 16-bit samples down to 8 bits, rounded: a shift of 8 for the MSB-aligned
+// P010, 2 for 10-bit planar
+using ShiftFn = void (*)(const uint16_t* src, uint8_t* dst, int n, int shift);
+// rounded average of two rows of n bytes
+using AverageFn = void (*)(const uint8_t* a, const uint8_t* b, uint8_t* dst,
+                           int n);
+
+void shiftScalar(const uint16_t* src, uint8_t* dst, int n, int shift) {
+  int round = 1 << (shift - 1);
+  for (int i = 0; i < n; i++) {
+    dst[i] = std::min((src[i] + round) >> shift, 255);
+  }
+}
+
+void averageScalar(const uint8_t* a, const uint8_t* b, uint8_t* dst, int n) {
+  for (int i = 0; i < n; i++) {
+    dst[i] = (a[i] + b[i] + 1) >> 1;
+  }
+}
+
+#ifdef ARCVP_X86
+void shiftSse2(const uint16_t* src, uint8_t* dst, int n, int shift) {
+  __m128i round = _mm_set1_epi16(1 << (shift - 1));
+  __m128i count = _mm_cvtsi32_si128(shift);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 8));
+    a = _mm_srl_epi16(_mm_adds_epu16(a, round), count);
+    b = _mm_srl_epi16(_mm_adds_epu16(b, round), count);
+    // anything past 8 bits saturates to 255
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                     _mm_packus_epi16(a, b));
+  }
+  shiftScalar(src + i, dst + i, n - i, shift);
+}
+
+void averageSse2(const uint8_t* a, const uint8_t* b, uint8_t* dst, int n) {
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+    __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_avg_epu8(x, y));
+  }
+  averageScalar(a + i, b + i, dst + i, n - i);
+}
+
+ARCVP_TARGET_AVX2
+void shiftAvx2(const uint16_t* src, uint8_t* dst, int n, int shift) {
+  __m256i round = _mm256_set1_epi16(1 << (shift - 1));
+  __m128i count = _mm_cvtsi32_si128(shift);
+  int i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+    __m256i b =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 16));
+    a = _mm256_srl_epi16(_mm256_adds_epu16(a, round), count);
+    b = _mm256_srl_epi16(_mm256_adds_epu16(b, round), count);
+    // packus works per 128-bit lane, put the quarters back in order
+    __m256i packed =
+        _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), packed);
+  }
+  shiftSse2(src + i, dst + i, n - i, shift);
+}
+
+ARCVP_TARGET_AVX2
+void averageAvx2(const uint8_t* a, const uint8_t* b, uint8_t* dst, int n) {
+  int i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+    __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i),
+                        _mm256_avg_epu8(x, y));
+  }
+  averageSse2(a + i, b + i, dst + i, n - i);
+}
+#endif
+
+struct Kernels {
+  ShiftFn shift;
+  AverageFn average;
+  const char* name;
+};
+
+Kernels pickKernels() {
+#ifdef ARCVP_X86
+  const CpuFeatures& cpu = CpuFeatures::get();
+  if (cpu.avx2) {
+    return {shiftAvx2, averageAvx2, "avx2"};
+  }
+  if (cpu.sse2) {
+    return {shiftSse2, averageSse2, "sse2"};
+  }
+#endif
+  return {shiftScalar, averageScalar, "scalar"};
+}
+
+const Kernels& kernels() {
+  static const Kernels picked = pickKernels();
+  return picked;
+}
+
+// 8-bit 4:2:0 planar, what the YV12 texture takes
+bool is420(int format) {
+  return format == AV_PIX_FMT_YUV420P || format == AV_PIX_FMT_YUVJ420P;
+}
+
+// row `y` of a plane, as T
+template <typename T>
+T* row(uint8_t* const* data, const int* linesize, int plane, int y) {
+  return reinterpret_cast<T*>(data[plane] + int64_t(y) * linesize[plane]);
+}
+}  // namespace
+
+PixelConverter::~PixelConverter() {
+  sws_freeContext(sws_);
+  // buffers still out in frames keep the pool alive until they come back
+  av_buffer_pool_uninit(&pool_);
+}
+
+AVPixelFormat PixelConverter::outputFormat(AVPixelFormat format) {
+  switch (format) {
+    case AV_PIX_FMT_NV12:
+    case AV_PIX_FMT_NV21:
+    case AV_PIX_FMT_P010LE:
+    case AV_PIX_FMT_P010BE:
+    case AV_PIX_FMT_P016LE:
+    case AV_PIX_FMT_P016BE:
+      return AV_PIX_FMT_NV12;
+    case AV_PIX_FMT_YUVJ420P:
+    case AV_PIX_FMT_YUVJ422P:
+    case AV_PIX_FMT_YUVJ444P:
+      // the full range is kept, as for the yuvj420p shown so far
+      return AV_PIX_FMT_YUVJ420P;
+    default:
+      return AV_PIX_FMT_YUV420P;
+  }
+}
+
+const char* PixelConverter::kernelName() { return kernels().name; }
+
+bool PixelConverter::needed(AVPixelFormat format) const {
+  return format != output_ && !(is420(format) && is420(output_));
+}
+
+const char* PixelConverter::pathName(AVPixelFormat format) const {
+  if (!needed(format)) {
+    return "none";
+  }
+  if (fast_paths_) {
+    if (format == AV_PIX_FMT_P010LE && output_ == AV_PIX_FMT_NV12) {
+      return "p010 to nv12";
+    }
+    if (format == AV_PIX_FMT_YUV420P10LE && is420(output_)) {
+      return "10 to 8 bit";
+    }
+    if ((format == AV_PIX_FMT_YUV422P || format == AV_PIX_FMT_YUVJ422P) &&
+        is420(output_)) {
+      return "4:2:2 to 4:2:0";
+    }
+  }
+  return "swscale";
+}
+
+bool PixelConverter::allocate(AVFrame* out, AVPixelFormat format, int width,
+                              int height) {
+  int size = av_image_get_buffer_size(format, width, height, 64);
+  if (size < 0) {
+    return false;
+  }
+  if (!pool_ || size_t(size) != pool_size_) {
+    av_buffer_pool_uninit(&pool_);
+    pool_ = av_buffer_pool_init(size, nullptr);
+    pool_size_ = size;
+    if (!pool_) {
+      return false;
+    }
+  }
+  out->buf[0] = av_buffer_pool_get(pool_);
+  if (!out->buf[0]) {
+    return false;
+  }
+  av_image_fill_arrays(out->data, out->linesize, out->buf[0]->data, format,
+                       width, height, 64);
+  out->extended_data = out->data;
+  out->format = format;
+  out->width = width;
+  out->height = height;
+  return true;
+}
+
+bool PixelConverter::convertFast(const AVFrame* in, AVFrame* out) {
+  const Kernels& k = kernels();
+  int width = in->width, height = in->height;
+  int chroma_width = (width + 1) / 2, chroma_height = (height + 1) / 2;
+  switch (in->format) {
+    case AV_PIX_FMT_P010LE:
+      if (output_ != AV_PIX_FMT_NV12 ||
+          !allocate(out, output_, width, height)) {
+        return false;
+      }
+      for (int y = 0; y < height; y++) {
+        k.shift(row<const uint16_t>(in->data, in->linesize, 0, y),
+                row<uint8_t>(out->data, out->linesize, 0, y), width, 8);
+      }
+      // interleaved U and V
+      for (int y = 0; y < chroma_height; y++) {
+        k.shift(row<const uint16_t>(in->data, in->linesize, 1, y),
+                row<uint8_t>(out->data, out->linesize, 1, y),
+                chroma_width * 2, 8);
+      }
+      return true;
+    case AV_PIX_FMT_YUV420P10LE:
+      if (!is420(output_) || !allocate(out, output_, width, height)) {
+        return false;
+      }
+      for (int plane = 0; plane < 3; plane++) {
+        int w = plane ? chroma_width : width;
+        int h = plane ? chroma_height : height;
+        for (int y = 0; y < h; y++) {
+          k.shift(row<const uint16_t>(in->data, in->linesize, plane, y),
+                  row<uint8_t>(out->data, out->linesize, plane, y), w, 2);
+        }
+      }
+      return true;
+    case AV_PIX_FMT_YUV422P:
+    case AV_PIX_FMT_YUVJ422P:
+      if (!is420(output_) || !allocate(out, output_, width, height)) {
+        return false;
+      }
+      av_image_copy_plane(out->data[0], out->linesize[0], in->data[0],
+                          in->linesize[0], width, height);
+      // every two chroma rows become one
+      for (int plane = 1; plane < 3; plane++) {
+        for (int y = 0; y < chroma_height; y++) {
+          k.average(row<const uint8_t>(in->data, in->linesize, plane, 2 * y),
+                    row<const uint8_t>(in->data, in->linesize, plane,
+                                 std::min(2 * y + 1, height - 1)),
+                    row<uint8_t>(out->data, out->linesize, plane, y),
+                    chroma_width);
+        }
+      }
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool PixelConverter::convert(const AVFrame* in, AVFrame* out) {
+  bool converted = fast_paths_ && convertFast(in, out);
+  if (!converted) {
+    av_frame_unref(out);
+    auto format = static_cast<AVPixelFormat>(in->format);
+    sws_ = sws_getCachedContext(sws_, in->width, in->height, format,
+                                in->width, in->height, output_, SWS_BILINEAR,
+                                nullptr, nullptr, nullptr);
+    if (!sws_) {
+      spdlog::error("Unable to convert {} pictures to {}",
+                    av_get_pix_fmt_name(format), av_get_pix_fmt_name(output_));
+      return false;
+    }
+    if (!allocate(out, output_, in->width, in->height)) {
+      spdlog::error("Unable to allocate a converted picture");
+      return false;
+    }
+    sws_scale(sws_, in->data, in->linesize, 0, in->height, out->data,
+              out->linesize);
+  }
+  av_frame_copy_props(out, in);
+  return true;
+}
+}  // namespace ArcVP
@@ -8,127 +8,172 @@
 using namespace std::chrono;
 
 namespace ArcVP {
-void Player::seekTo(std::int64_t milli){
-  std::scoped_lock lk{video_decode_worker_.mtx,audio_decode_worker_.mtx};
-  pause();
-
+void Player::seekTo(std::int64_t milli, SeekMode mode){
   spdlog::debug("current: {}s,seek to {}s",getPlayedMs()/1000.,milli/1000.);
-
-
-  if(media_.video_codec_context_!=nullptr) {
-    int64_t ts=timeToPts(milli,media_.video_stream_->time_base);
-    spdlog::debug("video pts: {}",ts);
-    int ret=av_seek_frame(media_.format_context_,media_.video_stream_index_,ts,AVSEEK_FLAG_BACKWARD);
-    if(ret<0) {
-      spdlog::error("Unable to seek ts: {}, {}",ts,av_err2str(ret));
-      return;
-    }
-    avcodec_flush_buffers(media_.video_codec_context_);
+  // everything queued so far is stale from here on, the consumers drop it as
+  // they get to it
+  int serial = ++seek_serial_;
+  for (auto worker : {&video_decode_worker_, &audio_decode_worker_}) {
+    worker->serial = serial;
+    worker->packet_chan.invalidate(serial);
   }
-
-  if(media_.audio_codec_context_!=nullptr) {
-    int64_t ts=timeToPts(milli,media_.audio_stream_->time_base);
-    spdlog::debug("audio pts: {}",ts);
-
-    int ret=av_seek_frame(media_.format_context_,media_.audio_stream_index_,ts,AVSEEK_FLAG_BACKWARD);
-    if(ret<0) {
-      spdlog::error("Unable to seek ts: {}, {}",ts,av_err2str(ret));
-      return;
+  pending_seek_frame_ = true;
+  degradation_.resetWindow();
+  if (audio_stream) {
+    // the stream lock keeps the device callback from counting samples while
+    // the position is reset
+    SDL_LockAudioStream(audio_stream);
+    pcm_ring_.discard(serial);
+    bool ok= SDL_ClearAudioStream(audio_stream);
+    if (!ok) {
+      spdlog::error("Unable to clear audio stream: {}",SDL_GetError());
+    }
+    sync_state_.sample_count_=(milli/1000.)*audio_rate_;
+    callback_media_carry_ = 0;
+    clock_.set(milli * 1000);
+    SDL_UnlockAudioStream(audio_stream);
+  } else {
+    if (hasAudio()) {
+      sync_state_.sample_count_=(milli/1000.)*audio_rate_;
     }
-    avcodec_flush_buffers(media_.audio_codec_context_);
+    clock_.set(milli * 1000);
   }
-  sync_state_.sample_count_=(milli/1000.)*media_.audio_codec_params_->sample_rate;
 
-  while (!video_decode_worker_.output_queue.queue.empty()) {
-    video_decode_worker_.output_queue.semReady.acquire();
-    video_decode_worker_.output_queue.mtx.lock();
-    auto front=video_decode_worker_.output_queue.queue.front();
-    av_frame_free(&front.frame);
-    video_decode_worker_.output_queue.queue.pop_front();
-    video_decode_worker_.output_queue.mtx.unlock();
-    video_decode_worker_.output_queue.semEmpty.release();
+  // a request still waiting in the slot is replaced, only the latest runs
+  if (seek_slot_.pending()) {
+    stats_.coalesced_seeks++;
   }
-
-  while (!audio_decode_worker_.output_queue.queue.empty()) {
-    audio_decode_worker_.output_queue.semReady.acquire();
-    audio_decode_worker_.output_queue.mtx.lock();
-    auto front=audio_decode_worker_.output_queue.queue.front();
-    av_frame_free(&front.frame);
-    audio_decode_worker_.output_queue.queue.pop_front();
-    audio_decode_worker_.output_queue.mtx.unlock();
-    audio_decode_worker_.output_queue.semEmpty.release();
+  seek_slot_.post({milli, mode, serial, nowUs()});
+  {
+    std::scoped_lock demux_lk{demux_worker_.mtx};
+    demux_worker_.status = WorkerStatus::Working;
   }
+  demux_worker_.cv.notify_all();
+}
 
-  while (!video_decode_worker_.packet_chan.empty()) {
-    av_packet_free(&video_decode_worker_.packet_chan.front());
-    video_decode_worker_.packet_chan.pop_front();
+// on the demux thread, between two packets
+void Player::performSeek(const SeekRequest& request) {
+  std::unique_lock format_lk{media_.format_mtx_};
+  switchAudioStream(request.serial);
+
+  // one seek on the stream we present from, the demuxer position is shared by
+  // every stream
+  int stream_index = media_.video_stream_index_ >= 0
+                         ? media_.video_stream_index_
+                         : media_.audio_stream_index_;
+  const AVStream* stream = media_.format_context_->streams[stream_index];
+  int64_t milli = request.target_ms;
+  int64_t ts = timeToPts(milli, stream->time_base);
+  // land exactly on the keyframe before the target, decoding is then bounded
+  // by one GOP
+  if (auto key = keyframe_index_.floor(stream_index, ts)) {
+    spdlog::debug("seek target pts: {}, keyframe pts: {}, packet #{}", ts,
+                  key->pts, key->packet_index);
+    ts = key->pts;
+    if (request.mode == SeekMode::Keyframe) {
+      // play on from the keyframe instead of decoding up to the target
+      milli = ptsToTime(key->pts, stream->time_base);
+    }
+  } else if (request.mode == SeekMode::Keyframe) {
+    // without the index we do not know where the demuxer lands, and a frame
+    // before the clock would be dropped as late
+    spdlog::debug("{}ms is not indexed yet, seeking exactly", milli);
   }
-
-  while (!audio_decode_worker_.packet_chan.empty()) {
-    av_packet_free(&audio_decode_worker_.packet_chan.front());
-    audio_decode_worker_.packet_chan.pop_front();
+  int ret = av_seek_frame(media_.format_context_, stream_index, ts,
+                          AVSEEK_FLAG_BACKWARD);
+  if (ret == AVERROR_EXIT || sync_state_.should_exit) {
+    // interrupted because we are quitting, the demux loop ends next
+    return;
+  }
+  if (ret < 0) {
+    spdlog::error("Unable to seek ts: {}, {}", ts, av_err2str(ret));
   }
-  demuxAllPackets();
-  bool ok= SDL_ClearAudioStream(audio_stream);
-  if (!ok) {
-    spdlog::error("Unable to clear audio stream: {}",SDL_GetError());
+  // packets read from here on carry the new serial, the decoders flush their
+  // codec when the first one arrives
+  demux_worker_.serial = request.serial;
+  format_lk.unlock();
+
+  for (auto worker : {&video_decode_worker_, &audio_decode_worker_}) {
+    bool presenting = worker == (hasVideo() ? &video_decode_worker_
+                                            : &audio_decode_worker_);
+    worker->setSeekTarget(
+        {request.serial, milli, presenting ? request.requested_us : 0});
   }
 
-  while (true) {
-    AVFrame* frame=decodeVideoFrame();
-    if (!frame) {
-      video_decode_worker_.output_queue.queue.emplace_back(nullptr,AV_NOPTS_VALUE);
-      break;
+  if (milli != request.target_ms) {
+    // keyframe seek, the clock goes back to where we really are. Under the
+    // stream lock seekTo can not move it to a newer target meanwhile.
+    if (audio_stream) {
+      SDL_LockAudioStream(audio_stream);
     }
-    // spdlog::debug("audio try lock audio queue");
-    int64_t present_ms = ptsToTime(frame->pts, media_.video_stream_->time_base);
-    if (present_ms<milli) {
-      av_frame_free(&frame);
-      continue;
+    if (request.serial == seek_serial_) {
+      if (hasAudio()) {
+        sync_state_.sample_count_ = (milli / 1000.) * audio_rate_;
+      }
+      clock_.set(milli * 1000);
     }
-
-    video_decode_worker_.output_queue.mtx.lock();
-    if (!video_decode_worker_.output_queue.queue.empty()) {
-      video_decode_worker_.output_queue.semReady.acquire();
-      auto front=video_decode_worker_.output_queue.queue.front();
-      av_frame_free(&front.frame);
-      video_decode_worker_.output_queue.queue.pop_front();
-      video_decode_worker_.output_queue.semEmpty.release();
+    if (audio_stream) {
+      SDL_UnlockAudioStream(audio_stream);
     }
-
-    video_decode_worker_.output_queue.semEmpty.acquire();
-    video_decode_worker_.output_queue.queue.emplace_back(frame,present_ms);
-    spdlog::debug("put video frame at: {}",present_ms);
-    video_decode_worker_.output_queue.mtx.unlock();
-    video_decode_worker_.output_queue.semReady.release();
-    break;
   }
+}
 
-  while (true) {
-    AVFrame* frame=decodeAudioFrame();
-    if (!frame) {
-      break;
-    }
-    // spdlog::debug("audio try lock audio queue");
-    int64_t present_ms = ptsToTime(frame->pts, media_.audio_stream_->time_base);
-    if (present_ms<milli) {
-      av_frame_free(&frame);
-      continue;
-    }
-    spdlog::debug("present audio frame ms: {}",present_ms);
-
-    resampleAudioFrame(frame);
-    SDL_PutAudioStreamData(audio_stream,audio_buffer_.data(),audio_buffer_.size());
-    spdlog::debug("SDL audio stream avail data size: {}",SDL_GetAudioStreamAvailable(audio_stream));
-    sync_state_.sample_count_ +=
-      audio_buffer_.size() / sizeof(float) /
-      media_.audio_codec_params_->ch_layout.nb_channels;
-    SDL_FlushAudioStream(audio_stream);
-    av_frame_free(&frame);
-    break;
+// on the demux thread with the format lock held, as part of the seek of
+// `serial`: from here on the demuxer reads the requested audio track instead
+// of the one playing
+void Player::switchAudioStream(int serial) {
+  std::scoped_lock lk{track_switch_mtx_};
+  if (!requested_track_.codec_context) {
+    return;
   }
+  AVStream** streams = media_.format_context_->streams;
+  streams[media_.audio_stream_index_]->discard = AVDISCARD_ALL;
+  streams[requested_track_.stream_index]->discard = AVDISCARD_DEFAULT;
+  media_.audio_stream_index_ = requested_track_.stream_index;
+  audio_decode_worker_.packet_chan.setTimeBase(
+      streams[requested_track_.stream_index]->time_base);
+  // the decoder never got to a previous switch, it is superseded
+  avcodec_free_context(&switched_track_.codec_context);
+  switched_track_ = std::exchange(requested_track_, {});
+  switched_track_.serial = serial;
+}
 
-  unpause();
+bool Player::selectAudioTrack(int stream_index) {
+  if (!hasAudio()) {
+    return false;
+  }
+  auto& tracks = media_.audio_tracks_;
+  if (std::none_of(tracks.begin(), tracks.end(), [&](const AudioTrack& track) {
+        return track.stream_index == stream_index;
+      })) {
+    spdlog::error("Stream {} is not an audio track", stream_index);
+    return false;
+  }
+  if (stream_index == audio_track_) {
+    return true;
+  }
+  const AVCodecParameters* params =
+      media_.format_context_->streams[stream_index]->codecpar;
+  const AVCodec* codec = avcodec_find_decoder(params->codec_id);
+  if (!codec) {
+    spdlog::error("Unable to find audio codec for stream {}", stream_index);
+    return false;
+  }
+  AVCodecContext* codecContext = openAudioCodec(codec, params);
+  if (!codecContext) {
+    return false;
+  }
+  {
+    std::scoped_lock lk{track_switch_mtx_};
+    // a switch the demuxer has not got to yet is replaced
+    avcodec_free_context(&requested_track_.codec_context);
+    requested_track_ = {stream_index, codec, codecContext, 0};
+  }
+  audio_track_ = stream_index;
+  spdlog::info("Switching audio to stream {}", stream_index);
+  // the decoders restart where we are, the audio one on the new track
+  seekTo(getPlayedMs(), SeekMode::Exact);
+  return true;
 }
 
 // void Player::speedUp(){
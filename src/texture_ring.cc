@@ -0,0 +1,251 @@
+//
+// Created by delta on 5/23/2025.
+//
+
+#include "texture_ring.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <utility>
+
+extern "C" {
+#include <libavutil/imgutils.h>
+}
+
+namespace ArcVP {
+
+namespace {
+bool isNv12(int format) { return format == AV_PIX_FMT_NV12; }
+}  // namespace
+
+SDL_PixelFormat TextureRing::textureFormat(AVPixelFormat format) {
+  return isNv12(format) ? SDL_PIXELFORMAT_NV12 : SDL_PIXELFORMAT_YV12;
+}
+
+bool TextureRing::create(SDL_Renderer* renderer, int width, int height,
+                         AVPixelFormat format, int depth, ReleaseFrame release,
+                         Uint32 wake_event, LatencyRecorder* upload_times) {
+  destroy();
+  width_ = width;
+  height_ = height;
+  format_ = format;
+  release_ = std::move(release);
+  wake_event_ = wake_event;
+  upload_times_ = upload_times;
+  slots_.resize(std::max(depth, 2));
+  for (Slot& slot : slots_) {
+    slot.texture = SDL_CreateTexture(renderer, textureFormat(format),
+                                     SDL_TEXTUREACCESS_STREAMING, width,
+                                     height);
+    if (!slot.texture) {
+      spdlog::error("Unable to create video texture: {}", SDL_GetError());
+      destroy();
+      return false;
+    }
+  }
+  exit_ = false;
+  uploader_ = std::thread([this] { uploadThreadWorker(); });
+  spdlog::info("Texture ring: {} {} textures of {}x{}", slots_.size(),
+               isNv12(format) ? "nv12" : "yv12", width, height);
+  return true;
+}
+
+void TextureRing::destroy() {
+  if (uploader_.joinable()) {
+    {
+      std::scoped_lock lk{mtx_};
+      exit_ = true;
+    }
+    cv_.notify_all();
+    uploader_.join();
+  }
+  for (Slot& slot : slots_) {
+    if (slot.frame) {
+      release_(slot.frame);
+      slot.frame = nullptr;
+    }
+    if (slot.state == State::Copying || slot.state == State::Ready) {
+      SDL_UnlockTexture(slot.texture);
+    }
+    if (slot.texture) {
+      SDL_DestroyTexture(slot.texture);
+    }
+  }
+  slots_.clear();
+  shown_ = -1;
+  changed_ = false;
+}
+
+bool TextureRing::accepts(const AVFrame* frame) const {
+  bool format = isNv12(format_) ? isNv12(frame->format)
+                                : frame->format == AV_PIX_FMT_YUV420P ||
+                                      frame->format == AV_PIX_FMT_YUVJ420P;
+  return format && frame->width == width_ && frame->height == height_;
+}
+
+// the locked pixels of a YV12 texture are the Y plane followed by V and U at
+// half the pitch, those of an NV12 texture the Y plane followed by the
+// interleaved UV plane
+void TextureRing::copy(Slot& slot) const {
+  const AVFrame* frame = slot.frame;
+  int chroma_pitch = (slot.pitch + 1) / 2;
+  int chroma_width = (width_ + 1) / 2, chroma_height = (height_ + 1) / 2;
+  uint8_t* y = slot.pixels;
+  if (isNv12(format_)) {
+    av_image_copy_plane(y, slot.pitch, frame->data[0], frame->linesize[0],
+                        width_, height_);
+    av_image_copy_plane(y + int64_t(slot.pitch) * height_, chroma_pitch * 2,
+                        frame->data[1], frame->linesize[1], chroma_width * 2,
+                        chroma_height);
+    return;
+  }
+  uint8_t* v = y + int64_t(slot.pitch) * height_;
+  uint8_t* u = v + int64_t(chroma_pitch) * chroma_height;
+  av_image_copy_plane(y, slot.pitch, frame->data[0], frame->linesize[0],
+                      width_, height_);
+  av_image_copy_plane(u, chroma_pitch, frame->data[1], frame->linesize[1],
+                      chroma_width, chroma_height);
+  av_image_copy_plane(v, chroma_pitch, frame->data[2], frame->linesize[2],
+                      chroma_width, chroma_height);
+}
+
+void TextureRing::uploadThreadWorker() {
+  std::unique_lock lk{mtx_};
+  while (true) {
+    Slot* next = nullptr;
+    cv_.wait(lk, [&] {
+      next = nullptr;
+      for (Slot& slot : slots_) {
+        if (slot.state == State::Copying &&
+            (!next || slot.sequence < next->sequence)) {
+          next = &slot;
+        }
+      }
+      return exit_ || next;
+    });
+    if (exit_) {
+      return;
+    }
+    // the slot is ours until it is Ready, the render thread does not touch
+    // a texture that is being copied into
+    AVFrame* frame = next->frame;
+    lk.unlock();
+    auto start = steady_clock::now();
+    copy(*next);
+    if (upload_times_) {
+      upload_times_->record(elapsedUs(start));
+    }
+    release_(frame);
+    lk.lock();
+    next->frame = nullptr;
+    next->state = State::Ready;
+    cv_.notify_all();
+    SDL_Event event{};
+    event.type = wake_event_;
+    SDL_PushEvent(&event);
+  }
+}
+
+bool TextureRing::submit(AVFrame* frame) {
+  if (!created() || !accepts(frame)) {
+    return false;
+  }
+  std::scoped_lock lk{mtx_};
+  for (Slot& slot : slots_) {
+    if (slot.state != State::Free) {
+      continue;
+    }
+    void* pixels = nullptr;
+    if (!SDL_LockTexture(slot.texture, nullptr, &pixels, &slot.pitch)) {
+      spdlog::error("Unable to lock video texture: {}", SDL_GetError());
+      return false;
+    }
+    slot.pixels = static_cast<uint8_t*>(pixels);
+    slot.frame = frame;
+    slot.sequence = next_sequence_++;
+    slot.state = State::Copying;
+    cv_.notify_all();
+    return true;
+  }
+  return false;
+}
+
+void TextureRing::waitCopies(std::unique_lock<std::mutex>& lk) {
+  cv_.wait(lk, [&] {
+    return std::none_of(slots_.begin(), slots_.end(), [](const Slot& slot) {
+      return slot.state == State::Copying;
+    });
+  });
+}
+
+void TextureRing::uploadNow(const AVFrame* frame) {
+  if (!created()) {
+    return;
+  }
+  {
+    std::unique_lock lk{mtx_};
+    waitCopies(lk);
+  }
+  // everything but the texture on screen is free after this
+  changed_ = collect() || changed_;
+  std::scoped_lock lk{mtx_};
+  for (int i = 0; i < int(slots_.size()); i++) {
+    Slot& slot = slots_[i];
+    if (slot.state != State::Free) {
+      continue;
+    }
+    auto start = steady_clock::now();
+    bool ok = isNv12(format_)
+                  ? SDL_UpdateNVTexture(slot.texture, nullptr, frame->data[0],
+                                        frame->linesize[0], frame->data[1],
+                                        frame->linesize[1])
+                  : SDL_UpdateYUVTexture(slot.texture, nullptr, frame->data[0],
+                                         frame->linesize[0], frame->data[1],
+                                         frame->linesize[1], frame->data[2],
+                                         frame->linesize[2]);
+    if (!ok) {
+      spdlog::error("Unable to update video texture: {}", SDL_GetError());
+      return;
+    }
+    if (upload_times_) {
+      upload_times_->record(elapsedUs(start));
+    }
+    if (shown_ >= 0) {
+      slots_[shown_].state = State::Free;
+    }
+    slot.sequence = next_sequence_++;
+    slot.state = State::Shown;
+    shown_ = i;
+    changed_ = true;
+    return;
+  }
+}
+
+bool TextureRing::collect() {
+  std::scoped_lock lk{mtx_};
+  int newest = -1;
+  for (int i = 0; i < int(slots_.size()); i++) {
+    Slot& slot = slots_[i];
+    if (slot.state != State::Ready) {
+      continue;
+    }
+    SDL_UnlockTexture(slot.texture);
+    slot.state = State::Free;
+    if (newest < 0 || slot.sequence > slots_[newest].sequence) {
+      newest = i;
+    }
+  }
+  bool changed = std::exchange(changed_, false);
+  if (newest >= 0) {
+    // anything older that finished alongside it is skipped
+    if (shown_ >= 0) {
+      slots_[shown_].state = State::Free;
+    }
+    slots_[newest].state = State::Shown;
+    shown_ = newest;
+    changed = true;
+  }
+  return changed;
+}
+}  // namespace ArcVP
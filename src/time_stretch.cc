@@ -0,0 +1,215 @@
+//
+// Created by delta on 5/19/2025.
+//
+
+#include "time_stretch.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "cpu_features.h"
+
+namespace ArcVP {
+namespace {
+
+// dot product of `ref` and `x`, and the energy of `x`, over n floats
+using CorrelateFn = void (*)(const float* ref, const float* x, size_t n,
+                             float& dot, float& energy);
+
+void correlateScalar(const float* ref, const float* x, size_t n, float& dot,
+                     float& energy) {
+  float d = 0, e = 0;
+  for (size_t i = 0; i < n; i++) {
+    d += ref[i] * x[i];
+    e += x[i] * x[i];
+  }
+  dot = d;
+  energy = e;
+}
+
+#ifdef ARCVP_X86
+void correlateSse(const float* ref, const float* x, size_t n, float& dot,
+                  float& energy) {
+  __m128 d0 = _mm_setzero_ps(), d1 = _mm_setzero_ps();
+  __m128 e0 = _mm_setzero_ps(), e1 = _mm_setzero_ps();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128 r0 = _mm_loadu_ps(ref + i), r1 = _mm_loadu_ps(ref + i + 4);
+    __m128 x0 = _mm_loadu_ps(x + i), x1 = _mm_loadu_ps(x + i + 4);
+    d0 = _mm_add_ps(d0, _mm_mul_ps(r0, x0));
+    d1 = _mm_add_ps(d1, _mm_mul_ps(r1, x1));
+    e0 = _mm_add_ps(e0, _mm_mul_ps(x0, x0));
+    e1 = _mm_add_ps(e1, _mm_mul_ps(x1, x1));
+  }
+  alignas(16) float d[4], e[4];
+  _mm_store_ps(d, _mm_add_ps(d0, d1));
+  _mm_store_ps(e, _mm_add_ps(e0, e1));
+  float dsum = d[0] + d[1] + d[2] + d[3];
+  float esum = e[0] + e[1] + e[2] + e[3];
+  for (; i < n; i++) {
+    dsum += ref[i] * x[i];
+    esum += x[i] * x[i];
+  }
+  dot = dsum;
+  energy = esum;
+}
+
+ARCVP_TARGET_AVX2
+void correlateAvx2(const float* ref, const float* x, size_t n, float& dot,
+                   float& energy) {
+  __m256 d0 = _mm256_setzero_ps(), d1 = _mm256_setzero_ps();
+  __m256 e0 = _mm256_setzero_ps(), e1 = _mm256_setzero_ps();
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256 r0 = _mm256_loadu_ps(ref + i), r1 = _mm256_loadu_ps(ref + i + 8);
+    __m256 x0 = _mm256_loadu_ps(x + i), x1 = _mm256_loadu_ps(x + i + 8);
+    d0 = _mm256_fmadd_ps(r0, x0, d0);
+    d1 = _mm256_fmadd_ps(r1, x1, d1);
+    e0 = _mm256_fmadd_ps(x0, x0, e0);
+    e1 = _mm256_fmadd_ps(x1, x1, e1);
+  }
+  alignas(32) float d[8], e[8];
+  _mm256_store_ps(d, _mm256_add_ps(d0, d1));
+  _mm256_store_ps(e, _mm256_add_ps(e0, e1));
+  float dsum = 0, esum = 0;
+  for (int k = 0; k < 8; k++) {
+    dsum += d[k];
+    esum += e[k];
+  }
+  for (; i < n; i++) {
+    dsum += ref[i] * x[i];
+    esum += x[i] * x[i];
+  }
+  dot = dsum;
+  energy = esum;
+}
+#endif
+
+struct Kernel {
+  CorrelateFn fn;
+  const char* name;
+};
+
+Kernel pickKernel() {
+#ifdef ARCVP_X86
+  const CpuFeatures& cpu = CpuFeatures::get();
+  if (cpu.avx2) {
+    return {correlateAvx2, "avx2"};
+  }
+  if (cpu.sse2) {
+    return {correlateSse, "sse"};
+  }
+#endif
+  return {correlateScalar, "scalar"};
+}
+
+const Kernel& kernel() {
+  static const Kernel picked = pickKernel();
+  return picked;
+}
+}  // namespace
+
+const char* TimeStretch::kernelName() { return kernel().name; }
+
+void TimeStretch::configure(int sample_rate, int channels,
+                            TimeStretchConfig config) {
+  channels_ = channels;
+  sequence_ = std::max(1, sample_rate * config.sequence_ms / 1000);
+  overlap_ = std::clamp(sample_rate * config.overlap_ms / 1000, 1,
+                        sequence_ / 2);
+  seek_ = std::max(1, sample_rate * config.seek_ms / 1000);
+  overlap_tail_.assign(size_t(overlap_) * channels_, 0);
+  reset();
+}
+
+void TimeStretch::reset() {
+  input_.clear();
+  input_start_ = 0;
+  skip_carry_ = 0;
+  has_tail_ = false;
+}
+
+// the offset in [0, seek) whose overlap best matches the tail of the last
+// piece, by normalized cross-correlation
+int TimeStretch::bestOffset(const float* candidates) const {
+  CorrelateFn correlate = kernel().fn;
+  size_t n = size_t(overlap_) * channels_;
+  int best = 0;
+  float best_score = -1e30f;
+  for (int offset = 0; offset < seek_; offset++) {
+    float dot, energy;
+    correlate(overlap_tail_.data(), candidates + size_t(offset) * channels_, n,
+              dot, energy);
+    float score = dot / std::sqrt(energy + 1e-9f);
+    if (score > best_score) {
+      best_score = score;
+      best = offset;
+    }
+  }
+  return best;
+}
+
+void TimeStretch::process(const float* in, size_t frames,
+                          std::vector<float>& out) {
+  size_t channels = channels_;
+  if (!active()) {
+    // back at normal speed, hand out what is still held back first
+    if (has_tail_ || !input_.empty()) {
+      drain(out);
+    }
+    out.insert(out.end(), in, in + frames * channels);
+    return;
+  }
+  input_.insert(input_.end(), in, in + frames * channels);
+  // input_start_ may point past the end after a long skip
+  auto available = [&] {
+    return int64_t(input_.size() / channels) - int64_t(input_start_);
+  };
+  while (available() >= sequence_ + seek_) {
+    const float* base = input_.data() + input_start_ * channels;
+    int offset = has_tail_ ? bestOffset(base) : 0;
+    const float* piece = base + size_t(offset) * channels;
+
+    size_t overlap = overlap_ * channels;
+    size_t body = (sequence_ - 2 * overlap_) * channels;
+    size_t at = out.size();
+    out.resize(at + overlap + body);
+    float* dst = out.data() + at;
+    if (has_tail_) {
+      for (int i = 0; i < overlap_; i++) {
+        float fade_in = float(i) / overlap_;
+        for (size_t c = 0; c < channels; c++) {
+          size_t k = i * channels + c;
+          dst[k] = overlap_tail_[k] * (1 - fade_in) + piece[k] * fade_in;
+        }
+      }
+    } else {
+      std::copy_n(piece, overlap, dst);
+    }
+    std::copy_n(piece + overlap, body, dst + overlap);
+    std::copy_n(piece + overlap + body, overlap, overlap_tail_.data());
+    has_tail_ = true;
+
+    // the input moves `speed` times as far as the output did
+    double skip = speed_ * (sequence_ - overlap_) + skip_carry_;
+    auto whole = static_cast<size_t>(skip);
+    skip_carry_ = skip - whole;
+    input_start_ += whole;
+  }
+  // drop what is behind us once in a while, not on every call
+  if (input_start_ > size_t(sequence_) * 8) {
+    size_t consumed = std::min(input_start_, input_.size() / channels);
+    input_.erase(input_.begin(), input_.begin() + consumed * channels);
+    input_start_ -= consumed;
+  }
+}
+
+void TimeStretch::drain(std::vector<float>& out) {
+  if (has_tail_) {
+    out.insert(out.end(), overlap_tail_.begin(), overlap_tail_.end());
+  }
+  size_t start = std::min(input_start_ * channels_, input_.size());
+  out.insert(out.end(), input_.begin() + start, input_.end());
+  reset();
+}
+}  // namespace ArcVP
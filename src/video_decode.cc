@@ -4,58 +4,156 @@
 #include "player.h"
 namespace ArcVP {
 
+// the first packet read after a seek: what the codec holds is from before it
+void Player::restartDecoder(DecodeWorker& worker,
+                            AVCodecContext* codec_context, int serial) {
+  avcodec_flush_buffers(codec_context);
+  worker.codec_serial = serial;
+  DecodeWorker::SeekTarget target = worker.seekTarget();
+  if (target.serial != serial) {
+    // a newer seek already ran, this serial is stale and gets dropped
+    target = {};
+  }
+  worker.preroll_ms = target.preroll_ms;
+  worker.seek_started_us = target.requested_us;
+}
+
 AVFrame* Player::decodeVideoFrame() {
-  AVFrame* frame = av_frame_alloc();
+  AVFrame* frame = frame_pool_.acquire();
   int ret = 0;
+  // time spent in the codec, not waiting for packets
+  int64_t codec_us = 0;
   while (true) {
+    auto start = steady_clock::now();
     ret = avcodec_receive_frame(media_.video_codec_context_, frame);
+    codec_us += elapsedUs(start);
     if (ret == 0) {
       break;
     }
+    if (ret == AVERROR_EOF && video_decode_worker_.serial == video_decode_worker_.codec_serial) {
+      // fully drained, and no seek to go on from
+      frame_pool_.release(frame);
+      return nullptr;
+    }
     if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-      if (video_decode_worker_.packet_chan.empty()) {
-        av_frame_free(&frame);
+      AVPacket* pkt = nullptr;
+      int serial = 0;
+      if (!video_decode_worker_.packet_chan.pop(pkt, serial)) {
+        frame_pool_.release(frame);
         return nullptr;
       }
-      auto pkt = video_decode_worker_.packet_chan.front();
-      video_decode_worker_.packet_chan.pop_front();
+      demux_worker_.wake();
+      if (serial != video_decode_worker_.codec_serial) {
+        restartDecoder(video_decode_worker_, media_.video_codec_context_, serial);
+      }
       if (!pkt) {
-        spdlog::info("Video Consumer exited due to closed channel");
-        video_decode_worker_.status = WorkerStatus::Exiting;
-        av_frame_free(&frame);
-        return nullptr;
+        spdlog::info("Video packet queue drained");
+        // enter draining mode, the frames still held by the codec follow
+        avcodec_send_packet(media_.video_codec_context_, nullptr);
+        continue;
+      }
+      // the presenting side decides how much work to skip under load
+      DegradationLevel level =
+          std::max(degradation_.level(), fastForward());
+      if (level != applied_degradation_) {
+        DegradationController::apply(media_.video_codec_context_, level);
+        applied_degradation_ = level;
+        spdlog::info("Video decode degradation: {}",
+                     degradationLevelName(level));
+      }
+      // nothing before the target of a seek is shown, frames no other frame
+      // refers to need not be decoded at all then. Only for packets known to
+      // end before it, the frame covering the target may be non-ref too.
+      int64_t preroll_ms = video_decode_worker_.preroll_ms;
+      bool before_target =
+          preroll_ms != AV_NOPTS_VALUE && pkt->pts != AV_NOPTS_VALUE &&
+          pkt->duration > 0 &&
+          pkt->pts + pkt->duration <=
+              timeToPts(preroll_ms, media_.video_stream_->time_base);
+      AVDiscard skip_frame = media_.video_codec_context_->skip_frame;
+      if (before_target && skip_frame < AVDISCARD_NONREF) {
+        media_.video_codec_context_->skip_frame = AVDISCARD_NONREF;
       }
+      start = steady_clock::now();
       ret = avcodec_send_packet(media_.video_codec_context_, pkt);
+      codec_us += elapsedUs(start);
+      media_.video_codec_context_->skip_frame = skip_frame;
       if (ret < 0) {
         spdlog::error("Error sending packet to codec: {}", av_err2str(ret));
       }
-      av_packet_free(&pkt);
+      packet_pool_.release(pkt);
     } else {
       spdlog::error("Unable to receive video frame: {}", av_err2str(ret));
-      av_frame_free(&frame);
+      frame_pool_.release(frame);
+      return nullptr;
     }
   }
+  stats_.video_decode.record(codec_us);
   return frame;
 
 }
 void Player::videoDecodeThreadWorker() {
   while (!sync_state_.should_exit) {
-    std::unique_lock lk{video_decode_worker_.mtx};
     AVFrame* frame=decodeVideoFrame();
+    int serial = video_decode_worker_.codec_serial;
     if (!frame) {
-      video_decode_worker_.output_queue.queue.emplace_back(nullptr,AV_NOPTS_VALUE);
+      video_decode_worker_.output_queue.push({nullptr, AV_NOPTS_VALUE, serial});
+      // nothing to wait for
+      firstFrameReady();
       break;
     }
-    lk.unlock();
-    // spdlog::debug("audio try lock audio queue");
-    int64_t present_ms = ptsToTime(frame->pts, media_.video_stream_->time_base);
-    video_decode_worker_.output_queue.semEmpty.acquire();
-    video_decode_worker_.output_queue.mtx.lock();
-    video_decode_worker_.output_queue.queue.emplace_back(frame,present_ms);
-    video_decode_worker_.output_queue.mtx.unlock();
-    video_decode_worker_.output_queue.semReady.release();
+    if (serial != video_decode_worker_.serial) {
+      // a seek is on its way, what is left of the old position is not shown
+      frame_pool_.release(frame);
+      continue;
+    }
+    video_decode_worker_.decode_rate.tick();
+    // frame threading keeps the output order, but pts may be missing on
+    // frames that left a reordering decoder
+    int64_t pts = frame->best_effort_timestamp != AV_NOPTS_VALUE
+                      ? frame->best_effort_timestamp
+                      : frame->pts;
+    int64_t present_ms = ptsToTime(pts, media_.video_stream_->time_base);
+    auto& queue = video_decode_worker_.output_queue;
+    int64_t duration_ms =
+        frame->duration > 0
+            ? ptsToTime(frame->duration, media_.video_stream_->time_base)
+            : queue.default_duration_ms;
+    auto& preroll_ms = video_decode_worker_.preroll_ms;
+    if (preroll_ms != AV_NOPTS_VALUE) {
+      // the first frame shown is the one on screen at the target
+      if (present_ms + std::max<int64_t>(duration_ms, 1) <= preroll_ms) {
+        stats_.preroll_frames++;
+        frame_pool_.release(frame);
+        continue;
+      }
+      preroll_ms = AV_NOPTS_VALUE;
+      auto& seek_started_us = video_decode_worker_.seek_started_us;
+      if (seek_started_us != 0) {
+        stats_.seek_first_frame.record(nowUs() - seek_started_us);
+        seek_started_us = 0;
+      }
+    }
+    if (pixel_converter_.needed(static_cast<AVPixelFormat>(frame->format))) {
+      // here rather than on the render thread, which only copies
+      AVFrame* converted = frame_pool_.acquire();
+      auto convert_start = steady_clock::now();
+      bool ok = pixel_converter_.convert(frame, converted);
+      stats_.convert.record(elapsedUs(convert_start));
+      frame_pool_.release(frame);
+      if (!ok) {
+        frame_pool_.release(converted);
+        continue;
+      }
+      frame = converted;
+    }
+    if (!queue.push({frame, present_ms, serial, FrameQueue::frameBytes(frame),
+                     duration_ms, nowUs()})) {
+      frame_pool_.release(frame);
+      continue;
+    }
+    firstFrameReady();
   }
-end:
   spdlog::info("Video decode thread exited");
 }
-}  // namespace ArcVP
\ No newline at end of file
+}  // namespace ArcVP